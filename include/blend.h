@@ -0,0 +1,255 @@
+/* See LICENSE for licence details. */
+/* alpha blending: premultiplied ARGB32 source over screen (source-over)
+	each row: decode dst (fb->buf: shadow buffer if enabled) -> blend -> encode, by chunk */
+enum blend_misc {
+	BLEND_CHUNK = 256, /* pixels blended at once (color buffer on stack): multiple of DITHER_SIZE */
+};
+
+/* x / 255 (rounded), exact for 0 <= x <= 255 * 255 */
+static inline uint32_t div255(uint32_t x)
+{
+	x += 128;
+	return (x + (x >> 8)) >> 8;
+}
+
+static inline uint32_t blend_over(uint32_t dst, uint32_t src)
+{
+	uint32_t inv = 255 - (src >> 24), color = 0, c;
+
+	for (int shift = 0; shift < 24; shift += 8) {
+		c = ((src >> shift) & 0xFF) + div255(((dst >> shift) & 0xFF) * inv);
+		color |= ((c > 0xFF) ? 0xFF: c) << shift;
+	}
+	return color;
+}
+
+#if defined(__SSE2__)
+static inline __m128i div255_epu16(__m128i x)
+{
+	x = _mm_add_epi16(x, _mm_set1_epi16(128));
+	return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+#endif
+
+/* dst (24bit color) = src (premultiplied ARGB) + dst * (255 - alpha) / 255 */
+void blend_over_n_base(uint32_t *dst, const uint32_t *src, int n)
+{
+	int i = 0;
+
+#if defined(__SSE2__)
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i max  = _mm_set1_epi32(0xFF);
+	const __m128i rgb  = _mm_set1_epi32(0xFFFFFF);
+	for (; i + 4 <= n; i += 4) {
+		__m128i s = _mm_loadu_si128((const __m128i *) (src + i));
+		__m128i d = _mm_loadu_si128((const __m128i *) (dst + i));
+		__m128i inv = _mm_sub_epi32(max, _mm_srli_epi32(s, 24));
+		__m128i lo, hi;
+
+		/* inverse alpha in every 16bit lane of pixel */
+		inv = _mm_or_si128(inv, _mm_slli_epi32(inv, 16));
+		lo  = _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi32(inv, inv));
+		hi  = _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi32(inv, inv));
+		d   = _mm_packus_epi16(div255_epu16(lo), div255_epu16(hi));
+
+		_mm_storeu_si128((__m128i *) (dst + i), _mm_and_si128(_mm_adds_epu8(s, d), rgb));
+	}
+#endif
+	for (; i < n; i++)
+		dst[i] = blend_over(dst[i], src[i]);
+}
+
+#if defined(CPU_DISPATCH)
+TARGET_AVX2
+static inline __m256i div255_epu16_256(__m256i x)
+{
+	x = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+	return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+}
+
+TARGET_AVX2
+void blend_over_n_avx2(uint32_t *dst, const uint32_t *src, int n)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i max  = _mm256_set1_epi32(0xFF);
+	const __m256i rgb  = _mm256_set1_epi32(0xFFFFFF);
+	int i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		__m256i s = _mm256_loadu_si256((const __m256i *) (src + i));
+		__m256i d = _mm256_loadu_si256((const __m256i *) (dst + i));
+		__m256i inv = _mm256_sub_epi32(max, _mm256_srli_epi32(s, 24));
+		__m256i lo, hi;
+
+		inv = _mm256_or_si256(inv, _mm256_slli_epi32(inv, 16));
+		lo  = _mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), _mm256_unpacklo_epi32(inv, inv));
+		hi  = _mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), _mm256_unpackhi_epi32(inv, inv));
+		d   = _mm256_packus_epi16(div255_epu16_256(lo), div255_epu16_256(hi));
+
+		_mm256_storeu_si256((__m256i *) (dst + i), _mm256_and_si256(_mm256_adds_epu8(s, d), rgb));
+	}
+	/* legacy SSE code follows */
+	_mm256_zeroupper();
+	blend_over_n_base(dst + i, src + i, n - i);
+}
+
+TARGET_AVX512
+static inline __m512i div255_epu16_512(__m512i x)
+{
+	x = _mm512_add_epi16(x, _mm512_set1_epi16(128));
+	return _mm512_srli_epi16(_mm512_add_epi16(x, _mm512_srli_epi16(x, 8)), 8);
+}
+
+TARGET_AVX512
+void blend_over_n_avx512(uint32_t *dst, const uint32_t *src, int n)
+{
+	const __m512i zero = _mm512_setzero_si512();
+	const __m512i max  = _mm512_set1_epi32(0xFF);
+	const __m512i rgb  = _mm512_set1_epi32(0xFFFFFF);
+	int i = 0;
+
+	for (; i + 16 <= n; i += 16) {
+		__m512i s = _mm512_loadu_si512((const void *) (src + i));
+		__m512i d = _mm512_loadu_si512((const void *) (dst + i));
+		__m512i inv = _mm512_sub_epi32(max, _mm512_srli_epi32(s, 24));
+		__m512i lo, hi;
+
+		inv = _mm512_or_si512(inv, _mm512_slli_epi32(inv, 16));
+		lo  = _mm512_mullo_epi16(_mm512_unpacklo_epi8(d, zero), _mm512_unpacklo_epi32(inv, inv));
+		hi  = _mm512_mullo_epi16(_mm512_unpackhi_epi8(d, zero), _mm512_unpackhi_epi32(inv, inv));
+		d   = _mm512_packus_epi16(div255_epu16_512(lo), div255_epu16_512(hi));
+
+		_mm512_storeu_si512((void *) (dst + i), _mm512_and_si512(_mm512_adds_epu8(s, d), rgb));
+	}
+	blend_over_n_avx2(dst + i, src + i, n - i);
+}
+#endif
+
+/* kernel for running cpu (selected by blend_dispatch()) */
+void (*blend_over_kernel)(uint32_t *dst, const uint32_t *src, int n) = blend_over_n_base;
+
+void blend_dispatch(enum cpu_level level)
+{
+	blend_over_kernel = blend_over_n_base;
+
+#if defined(CPU_DISPATCH)
+	if (level >= CPU_AVX512)
+		blend_over_kernel = blend_over_n_avx512;
+	else if (level >= CPU_AVX2)
+		blend_over_kernel = blend_over_n_avx2;
+#else
+	(void) level;
+#endif
+}
+
+void blend_over_n(uint32_t *dst, const uint32_t *src, int n)
+{
+	blend_over_kernel(dst, src, n);
+}
+
+/* threshold: dither row of dst (see dither.h) or NULL */
+void blend_span(struct fb_info_t *info, uint8_t *dst, const uint32_t *src, int n, const uint32_t *threshold)
+{
+	uint32_t colors[BLEND_CHUNK];
+	int len;
+
+	for (int i = 0; i < n; i += len) {
+		len = (n - i > BLEND_CHUNK) ? BLEND_CHUNK: n - i;
+
+		if (!pixel2color_n(info->format, colors, dst + i * info->bytes_per_pixel, len))
+			pixel2color_generic_n(info, colors, dst + i * info->bytes_per_pixel, len);
+		blend_over_n(colors, src + i, len);
+		color2pixel_dither_n(info, dst + i * info->bytes_per_pixel, colors, len, threshold);
+	}
+}
+
+void blend_row(struct fb_info_t *info, uint8_t *dst, const uint32_t *src, int n)
+{
+	blend_span(info, dst, src, n, NULL);
+}
+
+/* framebuffer memory: chunk is read by streaming loads onto stack, blended, then written by streaming copy */
+void blend_row_stream(struct fb_info_t *info, uint8_t *dst, const uint32_t *src, int n, const uint32_t *threshold)
+{
+	uint32_t pixels[BLEND_CHUNK];
+	int len, bpp = info->bytes_per_pixel;
+
+	for (int i = 0; i < n; i += len) {
+		len = (n - i > BLEND_CHUNK) ? BLEND_CHUNK: n - i;
+		stream_read((uint8_t *) pixels, dst + i * bpp, (size_t) len * bpp);
+		blend_span(info, (uint8_t *) pixels, src + i, len, threshold);
+		stream_copy(dst + i * bpp, (const uint8_t *) pixels, (size_t) len * bpp);
+	}
+}
+
+struct blend_job_t {
+	struct fb_info_t *info;
+	uint8_t *dst;
+	const uint8_t *src;            /* premultiplied ARGB32 */
+	int src_stride;
+	int width;
+	bool stream;                   /* dst is framebuffer memory */
+	const struct fb_dither_t *dither;
+	int x, y;                      /* position of dst on screen (phase of dither) */
+};
+
+void blend_band(void *arg, int y, int height)
+{
+	struct blend_job_t *job = (struct blend_job_t *) arg;
+	uint8_t *dst = job->dst + (long) y * job->info->line_length;
+	const uint8_t *line = job->src + (long) y * job->src_stride;
+	uint32_t row[DITHER_SIZE];
+	const uint32_t *threshold;
+
+	for (int h = 0; h < height; h++) {
+		threshold = dither_row(job->dither, row, job->x, job->y + y + h);
+		if (job->stream)
+			blend_row_stream(job->info, dst, (const uint32_t *) line, job->width, threshold);
+		else
+			blend_span(job->info, dst, (const uint32_t *) line, job->width, threshold);
+		dst  += job->info->line_length;
+		line += job->src_stride;
+	}
+}
+
+/* blend width x height pixels of src (premultiplied ARGB32, stride: bytes per line) at (x, y) (clipped) */
+void fb_blend(struct framebuffer_t *fb, int x, int y, const uint32_t *src, int src_stride,
+	int width, int height)
+{
+	struct fb_info_t *info = &fb->info;
+	const uint8_t *line = (const uint8_t *) src;
+	struct blend_job_t job;
+
+	/* clipping */
+	if (x < 0) {
+		line  -= x * 4;
+		width += x;
+		x = 0;
+	}
+	if (y < 0) {
+		line   -= (long) y * src_stride;
+		height += y;
+		y = 0;
+	}
+	if (width > info->width - x)
+		width = info->width - x;
+	if (height > info->height - y)
+		height = info->height - y;
+	if (width <= 0 || height <= 0)
+		return;
+
+	job.info       = info;
+	job.dst        = fb->buf + y * info->line_length + x * info->bytes_per_pixel;
+	job.src        = line;
+	job.src_stride = src_stride;
+	job.width      = width;
+	job.stream     = buf_is_device(fb);
+	job.dither     = &fb->dither;
+	job.x          = x;
+	job.y          = y;
+	fb_damage(fb, x, y, width, height);
+	stats_vram(fb, (long) width * height * info->bytes_per_pixel);
+	stats_add(&fb->stats.pixels_converted, (long) width * height);
+
+	fb_pool_run(fb, blend_band, &job, height, (long) width * height * info->bytes_per_pixel);
+}
@@ -30,6 +30,17 @@ int put_cmap(int fd, cmap_t *cmap)
 	return ioctl(fd, FBIOPUTCMAP, cmap);
 }
 
+/* upload entries [start, start + len) only: arrays of range begin at start */
+int put_cmap_range(int fd, cmap_t *cmap, int start, int len)
+{
+	struct fbcmap range = {
+		.index = start, .count = len,
+		.red = cmap->red + start, .green = cmap->green + start, .blue = cmap->blue + start,
+	};
+
+	return ioctl(fd, FBIOPUTCMAP, &range);
+}
+
 int get_cmap(int fd, cmap_t *cmap)
 {
 	return ioctl(fd, FBIOGETCMAP, cmap);
@@ -94,9 +105,12 @@ bool set_fbinfo(int fd, struct fb_info_t *info)
 
 	info->width  = vinfo.vi_width;
 	info->height = vinfo.vi_height;
-	info->screen_size = ainfo.va_window_size;
+	info->memory_size = ainfo.va_window_size;
 	info->line_length = ainfo.va_line_width;
 
+	info->height_virtual = info->height;
+	info->ypanstep       = 0;
+
 	info->bits_per_pixel  = vinfo.vi_depth;
 	info->bytes_per_pixel = my_ceil(vinfo.vi_depth, BITS_PER_BYTE);
 
@@ -105,3 +119,26 @@ bool set_fbinfo(int fd, struct fb_info_t *info)
 
 	return true;
 }
+
+/* panning is not supported */
+bool set_height_virtual(int fd, struct fb_info_t *info, int height_virtual)
+{
+	(void) fd;
+	(void) info;
+	(void) height_virtual;
+	return false;
+}
+
+bool pan_display(int fd, struct fb_info_t *info, int yoffset)
+{
+	(void) fd;
+	(void) info;
+	(void) yoffset;
+	return false;
+}
+
+bool wait_vsync(int fd)
+{
+	(void) fd;
+	return false;
+}
@@ -25,6 +25,17 @@ int put_cmap(int fd, cmap_t *cmap)
 	return ioctl(fd, WSDISPLAYIO_PUTCMAP, cmap);
 }
 
+/* upload entries [start, start + len) only: arrays of range begin at start */
+int put_cmap_range(int fd, cmap_t *cmap, int start, int len)
+{
+	struct wsdisplay_cmap range = {
+		.index = start, .count = len,
+		.red = cmap->red + start, .green = cmap->green + start, .blue = cmap->blue + start,
+	};
+
+	return ioctl(fd, WSDISPLAYIO_PUTCMAP, &range);
+}
+
 int get_cmap(int fd, cmap_t *cmap)
 {
 	return ioctl(fd, WSDISPLAYIO_GETCMAP, cmap);
@@ -85,10 +96,36 @@ bool set_fbinfo(int fd, struct fb_info_t *info)
 	info->bytes_per_pixel = my_ceil(finfo.depth, BITS_PER_BYTE);
 
 	info->line_length = info->bytes_per_pixel * info->width;
-	info->screen_size = info->height * info->line_length;
+	info->memory_size = (long) info->height * info->line_length;
+
+	info->height_virtual = info->height;
+	info->ypanstep       = 0;
 
 	set_bitfield(info->bits_per_pixel, &info->red, &info->green, &info->blue);
 	set_type_visual(info);
 
 	return true;
 }
+
+/* panning is not supported */
+bool set_height_virtual(int fd, struct fb_info_t *info, int height_virtual)
+{
+	(void) fd;
+	(void) info;
+	(void) height_virtual;
+	return false;
+}
+
+bool pan_display(int fd, struct fb_info_t *info, int yoffset)
+{
+	(void) fd;
+	(void) info;
+	(void) yoffset;
+	return false;
+}
+
+bool wait_vsync(int fd)
+{
+	(void) fd;
+	return false;
+}
@@ -0,0 +1,143 @@
+/* See LICENSE for licence details. */
+/* palette animation: modify entries of cmap (PSEUDOCOLOR: palette, DIRECTCOLOR: ramp of each channel)
+	modified entries are marked dirty, and fb_palette_commit() (called by fb_present() every frame)
+	uploads them by put_cmap_range() in coalesced ranges instead of full cmap */
+enum palette_misc {
+	PALETTE_MERGE_GAP = 8, /* entries: dirty ranges separated by shorter gap are uploaded at once */
+};
+
+/* 8bit color component -> cmap value of CMAP_COLOR_LENGTH bits (0xFF -> all bits set) */
+static inline uint16_t palette_value(uint32_t c)
+{
+	return ((c << 8) | c) >> (16 - CMAP_COLOR_LENGTH);
+}
+
+static inline void palette_mark(struct fb_palette_t *palette, int index)
+{
+	palette->dirty[index] = 1;
+
+	if (palette->first == palette->last) {
+		palette->first = index;
+		palette->last  = index + 1;
+	} else if (index < palette->first) {
+		palette->first = index;
+	} else if (index >= palette->last) {
+		palette->last = index + 1;
+	}
+}
+
+/* check range of entries, and allocate dirty map at first modification */
+bool palette_check(struct fb_palette_t *palette, int start, int n)
+{
+	if (palette->colors == 0) {
+		logging(ERROR, "palette: truecolor framebuffer has no cmap\n");
+		return false;
+	}
+
+	if (start < 0 || n < 0 || start + n > palette->colors) {
+		logging(ERROR, "palette: invalid range start:%d n:%d (colors:%d)\n", start, n, palette->colors);
+		return false;
+	}
+
+	if (!palette->dirty
+		&& (palette->dirty = (uint8_t *) ecalloc(palette->colors, sizeof(uint8_t))) == NULL)
+		return false;
+
+	return true;
+}
+
+/* set entries [start, start + n) to 24bit colors: unchanged entries are not marked */
+bool fb_palette_set(struct framebuffer_t *fb, int start, const uint32_t *colors, int n)
+{
+	cmap_t *cmap = fb->cmap;
+	uint16_t r, g, b;
+
+	if (!palette_check(&fb->palette, start, n))
+		return false;
+
+	for (int i = start; i < start + n; i++) {
+		r = palette_value((colors[i - start] >> 16) & 0xFF);
+		g = palette_value((colors[i - start] >> 8) & 0xFF);
+		b = palette_value(colors[i - start] & 0xFF);
+
+		if (cmap->red[i] == r && cmap->green[i] == g && cmap->blue[i] == b)
+			continue;
+
+		cmap->red[i]   = r;
+		cmap->green[i] = g;
+		cmap->blue[i]  = b;
+		palette_mark(&fb->palette, i);
+	}
+	return true;
+}
+
+/* reverse entries [from, to) of each channel */
+void palette_reverse(cmap_t *cmap, int from, int to)
+{
+	uint16_t tmp;
+
+	for (int i = from, j = to - 1; i < j; i++, j--) {
+		tmp = cmap->red[i];   cmap->red[i]   = cmap->red[j];   cmap->red[j]   = tmp;
+		tmp = cmap->green[i]; cmap->green[i] = cmap->green[j]; cmap->green[j] = tmp;
+		tmp = cmap->blue[i];  cmap->blue[i]  = cmap->blue[j];  cmap->blue[j]  = tmp;
+	}
+}
+
+/* palette cycling: rotate entries [start, start + n) by shift (entry i moves to i + shift) */
+bool fb_palette_rotate(struct framebuffer_t *fb, int start, int n, int shift)
+{
+	if (!palette_check(&fb->palette, start, n))
+		return false;
+
+	if (n == 0 || (shift = (shift % n + n) % n) == 0)
+		return true;
+
+	/* rotation by three reversals: in place, no temporary cmap */
+	palette_reverse(fb->cmap, start, start + n);
+	palette_reverse(fb->cmap, start, start + shift);
+	palette_reverse(fb->cmap, start + shift, start + n);
+
+	for (int i = start; i < start + n; i++)
+		palette_mark(&fb->palette, i);
+	return true;
+}
+
+/* upload dirty entries: each range covers dirty entries separated by gaps shorter than PALETTE_MERGE_GAP */
+bool fb_palette_commit(struct framebuffer_t *fb)
+{
+	struct fb_palette_t *palette = &fb->palette;
+	int start, end;
+	bool ok = true;
+
+	for (start = palette->first; start < palette->last; start = end) {
+		/* start is dirty: extend range to last dirty entry within merge gap */
+		end = start + 1;
+		for (int i = end; i < palette->last && i - end < PALETTE_MERGE_GAP; i++) {
+			if (palette->dirty[i])
+				end = i + 1;
+		}
+
+		stats_ioctl(fb, STATS_IOCTL_PUT_CMAP);
+		if (fb->backend->put_cmap_range(fb->fd, fb->cmap, start, end - start)) {
+			logging(ERROR, "put_cmap_range failed (start:%d len:%d)\n", start, end - start);
+			ok = false;
+		}
+		palette->uploads++;
+		palette->entries += end - start;
+		memset(palette->dirty + start, 0, end - start);
+
+		/* skip clean entries */
+		while (end < palette->last && !palette->dirty[end])
+			end++;
+	}
+	palette->first = palette->last = 0;
+
+	return ok;
+}
+
+void fb_palette_die(struct framebuffer_t *fb)
+{
+	free(fb->palette.dirty);
+	fb->palette.dirty = NULL;
+	fb->palette.first = fb->palette.last = 0;
+}
@@ -0,0 +1,937 @@
+/* See LICENSE for licence details. */
+/* pixel format: 24bit color (0xRRGGBB) -> framebuffer dependent pixel
+	specialized packers are selected by info->format (classified at fb_init) */
+#if defined(__SSE2__)
+	#include <emmintrin.h>
+#endif
+
+static inline uint32_t color2xrgb8888(uint32_t color)
+{
+	return color & 0xFFFFFF;
+}
+
+static inline uint32_t color2xbgr8888(uint32_t color)
+{
+	return ((color & 0xFF0000) >> 16) | (color & 0x00FF00) | ((color & 0x0000FF) << 16);
+}
+
+static inline uint32_t color2rgb888(uint32_t color)
+{
+	/* same value as xrgb8888, but stored in 3 bytes */
+	return color & 0xFFFFFF;
+}
+
+static inline uint32_t color2rgb565(uint32_t color)
+{
+	return ((color >> 8) & 0xF800) | ((color >> 5) & 0x07E0) | ((color >> 3) & 0x001F);
+}
+
+static inline uint32_t color2rgb555(uint32_t color)
+{
+	return ((color >> 9) & 0x7C00) | ((color >> 6) & 0x03E0) | ((color >> 3) & 0x001F);
+}
+
+static inline uint32_t color2rgb332(uint32_t color)
+{
+	return ((color >> 16) & 0xE0) | ((color >> 11) & 0x1C) | ((color >> 6) & 0x03);
+}
+
+static inline uint32_t color2pixel_generic(struct fb_info_t *info, uint32_t color)
+{
+	uint32_t r, g, b;
+
+	r = bit_mask[BITS_PER_RGB] & (color >> (BITS_PER_RGB * 2));
+	g = bit_mask[BITS_PER_RGB] & (color >>  BITS_PER_RGB);
+	b = bit_mask[BITS_PER_RGB] & (color >>  0);
+
+	r = r >> (BITS_PER_RGB - info->red.length);
+	g = g >> (BITS_PER_RGB - info->green.length);
+	b = b >> (BITS_PER_RGB - info->blue.length);
+
+	return (r << info->red.offset)
+			+ (g << info->green.offset)
+			+ (b << info->blue.offset);
+}
+
+static inline uint32_t color2pixel(struct fb_info_t *info, uint32_t color)
+{
+	switch (info->format) {
+	case YAFT_FB_FORMAT_XRGB8888:
+		return color2xrgb8888(color);
+	case YAFT_FB_FORMAT_XBGR8888:
+		return color2xbgr8888(color);
+	case YAFT_FB_FORMAT_RGB888:
+		return color2rgb888(color);
+	case YAFT_FB_FORMAT_RGB565:
+		return color2rgb565(color);
+	case YAFT_FB_FORMAT_RGB555:
+		return color2rgb555(color);
+	case YAFT_FB_FORMAT_RGB332:
+		return color2rgb332(color);
+	default:
+		return color2pixel_generic(info, color);
+	}
+}
+
+static inline bool bitfield_equal(struct bitfield_t *bf, int offset, int length)
+{
+	return bf->offset == offset && bf->length == length;
+}
+
+/* must be called after bitfields are fixed (init_indexcolor() overwrites them in pseudocolor) */
+enum fb_format get_format(struct fb_info_t *info)
+{
+	struct bitfield_t *r = &info->red, *g = &info->green, *b = &info->blue;
+
+	switch (info->bits_per_pixel) {
+	case 32:
+		if (bitfield_equal(r, 16, 8) && bitfield_equal(g, 8, 8) && bitfield_equal(b, 0, 8))
+			return YAFT_FB_FORMAT_XRGB8888;
+		if (bitfield_equal(r, 0, 8) && bitfield_equal(g, 8, 8) && bitfield_equal(b, 16, 8))
+			return YAFT_FB_FORMAT_XBGR8888;
+		break;
+	case 24:
+		if (bitfield_equal(r, 16, 8) && bitfield_equal(g, 8, 8) && bitfield_equal(b, 0, 8))
+			return YAFT_FB_FORMAT_RGB888;
+		break;
+	case 16:
+		if (bitfield_equal(r, 11, 5) && bitfield_equal(g, 5, 6) && bitfield_equal(b, 0, 5))
+			return YAFT_FB_FORMAT_RGB565;
+		/* fall through */
+	case 15:
+		if (bitfield_equal(r, 10, 5) && bitfield_equal(g, 5, 5) && bitfield_equal(b, 0, 5))
+			return YAFT_FB_FORMAT_RGB555;
+		break;
+	case 8:
+		if (bitfield_equal(r, 5, 3) && bitfield_equal(g, 2, 3) && bitfield_equal(b, 0, 2))
+			return YAFT_FB_FORMAT_RGB332;
+		break;
+	default:
+		break;
+	}
+	return YAFT_FB_FORMAT_GENERIC;
+}
+
+/* store pixel in framebuffer memory order (little endian) */
+static inline void store_pixel(uint8_t *dst, uint32_t pixel, int bytes_per_pixel)
+{
+	switch (bytes_per_pixel) {
+	case 4:
+		memcpy(dst, &pixel, 4);
+		break;
+	case 3:
+		dst[0] = pixel; dst[1] = pixel >> 8; dst[2] = pixel >> 16;
+		break;
+	case 2:
+		*dst++ = pixel; *dst = pixel >> 8;
+		break;
+	default:
+		*dst = pixel;
+		break;
+	}
+}
+
+/* inverse conversion: pixel -> 24bit color (lower bits are filled by bit replication) */
+static inline uint32_t expand_bits(uint32_t value, int length)
+{
+	/* value has length bits (1-8): replicate to 8 bits (0: component is absent) */
+	uint32_t ret;
+
+	if (length <= 0)
+		return 0;
+
+	ret = value << (8 - length);
+
+	for (int l = length; l < 8; l += length)
+		ret |= ret >> l;
+	return ret & 0xFF;
+}
+
+static inline uint32_t pixel2color_rgb565(uint32_t pixel)
+{
+	return (expand_bits((pixel >> 11) & 0x1F, 5) << 16)
+		| (expand_bits((pixel >> 5) & 0x3F, 6) << 8) | expand_bits(pixel & 0x1F, 5);
+}
+
+static inline uint32_t pixel2color_rgb555(uint32_t pixel)
+{
+	return (expand_bits((pixel >> 10) & 0x1F, 5) << 16)
+		| (expand_bits((pixel >> 5) & 0x1F, 5) << 8) | expand_bits(pixel & 0x1F, 5);
+}
+
+static inline uint32_t pixel2color_rgb332(uint32_t pixel)
+{
+	return (expand_bits((pixel >> 5) & 0x07, 3) << 16)
+		| (expand_bits((pixel >> 2) & 0x07, 3) << 8) | expand_bits(pixel & 0x03, 2);
+}
+
+static inline uint32_t pixel2color_generic(struct fb_info_t *info, uint32_t pixel)
+{
+	const struct bitfield_t *bf[] = {&info->red, &info->green, &info->blue};
+	uint32_t color = 0, value;
+
+	for (int i = 0; i < 3; i++) {
+		value = (pixel >> bf[i]->offset) & bit_mask[bf[i]->length];
+		value = (bf[i]->length > 8) ? value >> (bf[i]->length - 8): expand_bits(value, bf[i]->length);
+		color = (color << 8) | value;
+	}
+	return color;
+}
+
+static inline uint32_t load_pixel(const uint8_t *src, int bytes_per_pixel)
+{
+	uint32_t pixel = 0;
+
+	switch (bytes_per_pixel) {
+	case 4:
+		memcpy(&pixel, src, 4);
+		break;
+	case 3:
+		pixel = src[0] | (src[1] << 8) | (src[2] << 16);
+		break;
+	case 2:
+		pixel = src[0] | (src[1] << 8);
+		break;
+	default:
+		pixel = *src;
+		break;
+	}
+	return pixel;
+}
+
+/* 24bpp: group of 4 pixels is 12 bytes (3 words) */
+static inline void store_rgb888_x4(uint8_t *dst, uint32_t p0, uint32_t p1, uint32_t p2, uint32_t p3)
+{
+	uint32_t word[3];
+
+	word[0] = (p0 & 0xFFFFFF) | (p1 << 24);
+	word[1] = ((p1 >> 8) & 0xFFFF) | (p2 << 16);
+	word[2] = ((p2 >> 16) & 0xFF) | (p3 << 8);
+	memcpy(dst, word, 12);
+}
+
+static inline void load_rgb888_x4(uint32_t *dst, const uint8_t *src)
+{
+	uint32_t word[3];
+
+	memcpy(word, src, 12);
+	dst[0] = word[0] & 0xFFFFFF;
+	dst[1] = (word[0] >> 24) | ((word[1] & 0xFFFF) << 8);
+	dst[2] = (word[1] >> 16) | ((word[2] & 0xFF) << 16);
+	dst[3] = word[2] >> 8;
+}
+
+/* ordered dithering (see dither.h): component c of length bits is scaled to c - (c >> length)
+	(levels of length bits are spread over 0-255 by bit replication), then threshold
+	(0 to 2^(8 - length) - 1) is added before truncation: sum never exceeds 255
+	mask0/mask1: components of length shift0/shift1 */
+static inline uint32_t dither_add(uint32_t color, uint32_t threshold,
+	int shift0, uint32_t mask0, int shift1, uint32_t mask1)
+{
+	return color - (((color >> shift0) & mask0) | ((color >> shift1) & mask1)) + threshold;
+}
+
+/* batch conversion: src (array of 24bit color) -> dst (framebuffer pixels, no alignment required)
+	each kernel processes vector width at once, and the rest by scalar packer
+	variants: _base (compile-time instruction set: SSE2 or scalar), _ssse3/_avx2 (runtime, see cpu.h)
+	_avx2 clears upper halves of ymm before tail by _base (gcc omits vzeroupper on tail call) */
+void color2xrgb8888_n_base(uint8_t *dst, const uint32_t *src, int n)
+{
+	int i = 0;
+
+#if defined(__SSE2__)
+	const __m128i mask = _mm_set1_epi32(0xFFFFFF);
+	for (; i + 4 <= n; i += 4) {
+		__m128i c = _mm_loadu_si128((const __m128i *) (src + i));
+		_mm_storeu_si128((__m128i *) (dst + i * 4), _mm_and_si128(c, mask));
+	}
+#endif
+	for (; i < n; i++)
+		store_pixel(dst + i * 4, color2xrgb8888(src[i]), 4);
+}
+
+void color2xbgr8888_n_base(uint8_t *dst, const uint32_t *src, int n)
+{
+	int i = 0;
+
+#if defined(__SSE2__)
+	const __m128i mask_g = _mm_set1_epi32(0x00FF00);
+	const __m128i mask_b = _mm_set1_epi32(0x0000FF);
+	for (; i + 4 <= n; i += 4) {
+		__m128i c = _mm_loadu_si128((const __m128i *) (src + i));
+		__m128i p = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(c, 16), mask_b),
+			_mm_or_si128(_mm_and_si128(c, mask_g),
+			_mm_slli_epi32(_mm_and_si128(c, mask_b), 16)));
+		_mm_storeu_si128((__m128i *) (dst + i * 4), p);
+	}
+#endif
+	for (; i < n; i++)
+		store_pixel(dst + i * 4, color2xbgr8888(src[i]), 4);
+}
+
+#if defined(__SSE2__)
+/* 32bit lanes (value < 0x10000) -> 16bit lanes
+	_mm_packs_epi32 saturates signed value, so sign extend lower 16bit at first */
+static inline __m128i pack_epi32_epi16(__m128i lo, __m128i hi)
+{
+	lo = _mm_srai_epi32(_mm_slli_epi32(lo, 16), 16);
+	hi = _mm_srai_epi32(_mm_slli_epi32(hi, 16), 16);
+	return _mm_packs_epi32(lo, hi);
+}
+
+/* see dither_add() */
+static inline __m128i dither_add_epi32(__m128i c, __m128i t, int shift0, __m128i mask0, int shift1, __m128i mask1)
+{
+	__m128i scale = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(c, shift0), mask0),
+		_mm_and_si128(_mm_srli_epi32(c, shift1), mask1));
+	return _mm_add_epi32(_mm_sub_epi32(c, scale), t);
+}
+
+/* shift of each color component: (color >> shift) & mask */
+static inline __m128i pack_rgb16(__m128i c, int r_shift, int g_shift, int b_shift,
+	__m128i r_mask, __m128i g_mask, __m128i b_mask)
+{
+	return _mm_or_si128(_mm_and_si128(_mm_srli_epi32(c, r_shift), r_mask),
+		_mm_or_si128(_mm_and_si128(_mm_srli_epi32(c, g_shift), g_mask),
+		_mm_and_si128(_mm_srli_epi32(c, b_shift), b_mask)));
+}
+#endif
+
+/* rgb565: r_shift:8 g_shift:5 b_shift:3, rgb555: r_shift:9 g_shift:6 b_shift:3
+	threshold: dither row (threshold[i & 7] is for pixel i) or NULL
+	scale5/scale6: components of length 5/6 (see dither_add()) */
+static inline void color2rgb16_n(uint8_t *dst, const uint32_t *src, int n,
+	int r_shift, int g_shift, uint32_t r_mask, uint32_t g_mask, uint32_t (*packer)(uint32_t),
+	const uint32_t *threshold, uint32_t scale5, uint32_t scale6)
+{
+	int i = 0;
+
+#if defined(__SSE2__)
+	const __m128i r128 = _mm_set1_epi32(r_mask);
+	const __m128i g128 = _mm_set1_epi32(g_mask);
+	const __m128i b128 = _mm_set1_epi32(0x001F);
+	const __m128i s5 = _mm_set1_epi32(scale5), s6 = _mm_set1_epi32(scale6);
+	__m128i t_lo = _mm_setzero_si128(), t_hi = _mm_setzero_si128();
+
+	if (threshold) {
+		t_lo = _mm_loadu_si128((const __m128i *) threshold);
+		t_hi = _mm_loadu_si128((const __m128i *) (threshold + 4));
+	}
+	for (; i + 8 <= n; i += 8) {
+		__m128i lo = _mm_loadu_si128((const __m128i *) (src + i));
+		__m128i hi = _mm_loadu_si128((const __m128i *) (src + i + 4));
+		if (threshold) {
+			lo = dither_add_epi32(lo, t_lo, 5, s5, 6, s6);
+			hi = dither_add_epi32(hi, t_hi, 5, s5, 6, s6);
+		}
+		lo = pack_rgb16(lo, r_shift, g_shift, 3, r128, g128, b128);
+		hi = pack_rgb16(hi, r_shift, g_shift, 3, r128, g128, b128);
+		_mm_storeu_si128((__m128i *) (dst + i * 2), pack_epi32_epi16(lo, hi));
+	}
+#else
+	(void) r_shift; (void) g_shift; (void) r_mask; (void) g_mask;
+#endif
+	for (; i < n; i++)
+		store_pixel(dst + i * 2, packer(threshold ?
+			dither_add(src[i], threshold[i & 7], 5, scale5, 6, scale6): src[i]), 2);
+}
+
+void color2rgb565_n_base(uint8_t *dst, const uint32_t *src, int n)
+{
+	color2rgb16_n(dst, src, n, 8, 5, 0xF800, 0x07E0, color2rgb565, NULL, 0, 0);
+}
+
+void color2rgb555_n_base(uint8_t *dst, const uint32_t *src, int n)
+{
+	color2rgb16_n(dst, src, n, 9, 6, 0x7C00, 0x03E0, color2rgb555, NULL, 0, 0);
+}
+
+void color2rgb565_dither_n_base(uint8_t *dst, const uint32_t *src, int n, const uint32_t *threshold)
+{
+	color2rgb16_n(dst, src, n, 8, 5, 0xF800, 0x07E0, color2rgb565, threshold, 0x070007, 0x000300);
+}
+
+void color2rgb555_dither_n_base(uint8_t *dst, const uint32_t *src, int n, const uint32_t *threshold)
+{
+	color2rgb16_n(dst, src, n, 9, 6, 0x7C00, 0x03E0, color2rgb555, threshold, 0x070707, 0);
+}
+
+/* rgb332: 16 pixels -> 16 bytes, threshold: same as color2rgb16_n() */
+static inline void color2rgb8_n(uint8_t *dst, const uint32_t *src, int n, const uint32_t *threshold)
+{
+	int i = 0;
+
+#if defined(__SSE2__)
+	const __m128i r_mask = _mm_set1_epi32(0xE0);
+	const __m128i g_mask = _mm_set1_epi32(0x1C);
+	const __m128i b_mask = _mm_set1_epi32(0x03);
+	const __m128i s3 = _mm_set1_epi32(0x1F1F00), s2 = _mm_set1_epi32(0x00003F);
+	__m128i t_lo = _mm_setzero_si128(), t_hi = _mm_setzero_si128(), p[4];
+
+	if (threshold) {
+		t_lo = _mm_loadu_si128((const __m128i *) threshold);
+		t_hi = _mm_loadu_si128((const __m128i *) (threshold + 4));
+	}
+	for (; i + 16 <= n; i += 16) {
+		for (int j = 0; j < 4; j++) {
+			p[j] = _mm_loadu_si128((const __m128i *) (src + i + j * 4));
+			if (threshold)
+				p[j] = dither_add_epi32(p[j], (j & 1) ? t_hi: t_lo, 3, s3, 2, s2);
+			p[j] = pack_rgb16(p[j], 16, 11, 6, r_mask, g_mask, b_mask);
+		}
+		/* each lane is less than 256: signed saturation does not change value */
+		_mm_storeu_si128((__m128i *) (dst + i),
+			_mm_packus_epi16(_mm_packs_epi32(p[0], p[1]), _mm_packs_epi32(p[2], p[3])));
+	}
+#endif
+	for (; i < n; i++)
+		dst[i] = color2rgb332(threshold ? dither_add(src[i], threshold[i & 7], 3, 0x1F1F00, 2, 0x00003F): src[i]);
+}
+
+#if defined(__SSE2__)
+/* 4 pixels (32bit lanes) -> 12 bytes at lower bytes of vector */
+static inline __m128i pack_rgb24(__m128i c)
+{
+	const __m128i mask    = _mm_set1_epi32(0xFFFFFF);
+	const __m128i mask_lo = _mm_set_epi32(0, -1, 0, -1);
+	const __m128i mask_q0 = _mm_set_epi32(0, 0, -1, -1);
+
+	c = _mm_and_si128(c, mask);
+	/* 6 bytes packed in each 64bit lane */
+	c = _mm_or_si128(_mm_and_si128(c, mask_lo), _mm_srli_epi64(_mm_andnot_si128(mask_lo, c), 8));
+	/* join upper 6 bytes to lower 6 bytes */
+	return _mm_or_si128(_mm_and_si128(c, mask_q0), _mm_srli_si128(_mm_andnot_si128(mask_q0, c), 2));
+}
+#endif
+
+void color2rgb888_n_base(uint8_t *dst, const uint32_t *src, int n)
+{
+	int i = 0;
+
+#if defined(__SSE2__)
+	/* 16 pixels -> 48 bytes (3 stores) */
+	for (; i + 16 <= n; i += 16) {
+		__m128i p0 = pack_rgb24(_mm_loadu_si128((const __m128i *) (src + i)));
+		__m128i p1 = pack_rgb24(_mm_loadu_si128((const __m128i *) (src + i + 4)));
+		__m128i p2 = pack_rgb24(_mm_loadu_si128((const __m128i *) (src + i + 8)));
+		__m128i p3 = pack_rgb24(_mm_loadu_si128((const __m128i *) (src + i + 12)));
+		uint8_t *d = dst + i * 3;
+
+		_mm_storeu_si128((__m128i *) (d +  0), _mm_or_si128(p0, _mm_slli_si128(p1, 12)));
+		_mm_storeu_si128((__m128i *) (d + 16), _mm_or_si128(_mm_srli_si128(p1, 4), _mm_slli_si128(p2, 8)));
+		_mm_storeu_si128((__m128i *) (d + 32), _mm_or_si128(_mm_srli_si128(p2, 8), _mm_slli_si128(p3, 4)));
+	}
+#endif
+	for (; i + 4 <= n; i += 4)
+		store_rgb888_x4(dst + i * 3, src[i], src[i + 1], src[i + 2], src[i + 3]);
+	for (; i < n; i++)
+		store_pixel(dst + i * 3, color2rgb888(src[i]), 3);
+}
+
+/* inverse batch conversion: src (pixels of format) -> dst (array of 24bit color) */
+#if defined(__SSE2__)
+/* 5/6 bits components in 32bit lanes -> 8 bits (bit replication) */
+static inline __m128i expand_rgb16(__m128i p, int r_shift, int g_shift, int g_length)
+{
+	const __m128i mask5 = _mm_set1_epi32(0x1F);
+	const __m128i maskg = _mm_set1_epi32((1 << g_length) - 1);
+	__m128i r, g, b;
+
+	r = _mm_and_si128(_mm_srli_epi32(p, r_shift), mask5);
+	g = _mm_and_si128(_mm_srli_epi32(p, g_shift), maskg);
+	b = _mm_and_si128(p, mask5);
+
+	r = _mm_or_si128(_mm_slli_epi32(r, 3), _mm_srli_epi32(r, 2));
+	g = (g_length == 6) ? _mm_or_si128(_mm_slli_epi32(g, 2), _mm_srli_epi32(g, 4))
+		: _mm_or_si128(_mm_slli_epi32(g, 3), _mm_srli_epi32(g, 2));
+	b = _mm_or_si128(_mm_slli_epi32(b, 3), _mm_srli_epi32(b, 2));
+
+	return _mm_or_si128(_mm_slli_epi32(r, 16), _mm_or_si128(_mm_slli_epi32(g, 8), b));
+}
+#endif
+
+static inline void pixel2color_rgb16_n(uint32_t *dst, const uint8_t *src, int n,
+	int r_shift, int g_length, uint32_t (*unpacker)(uint32_t))
+{
+	int i = 0;
+
+#if defined(__SSE2__)
+	const __m128i zero = _mm_setzero_si128();
+	for (; i + 8 <= n; i += 8) {
+		__m128i p = _mm_loadu_si128((const __m128i *) (src + i * 2));
+		_mm_storeu_si128((__m128i *) (dst + i),
+			expand_rgb16(_mm_unpacklo_epi16(p, zero), r_shift, 5, g_length));
+		_mm_storeu_si128((__m128i *) (dst + i + 4),
+			expand_rgb16(_mm_unpackhi_epi16(p, zero), r_shift, 5, g_length));
+	}
+#else
+	(void) r_shift; (void) g_length;
+#endif
+	for (; i < n; i++)
+		dst[i] = unpacker(load_pixel(src + i * 2, 2));
+}
+
+void pixel2color_rgb565_n_base(uint32_t *dst, const uint8_t *src, int n)
+{
+	pixel2color_rgb16_n(dst, src, n, 11, 6, pixel2color_rgb565);
+}
+
+void pixel2color_rgb555_n_base(uint32_t *dst, const uint8_t *src, int n)
+{
+	pixel2color_rgb16_n(dst, src, n, 10, 5, pixel2color_rgb555);
+}
+
+void pixel2color_rgb888_n_base(uint32_t *dst, const uint8_t *src, int n)
+{
+	int i = 0;
+
+	for (; i + 4 <= n; i += 4)
+		load_rgb888_x4(dst + i, src + i * 3);
+	for (; i < n; i++)
+		dst[i] = load_pixel(src + i * 3, 3);
+}
+
+#if defined(CPU_DISPATCH)
+/* 24bpp by pshufb: 4 colors (16 bytes) <-> 4 pixels (12 bytes), 16 pixels are 3 vectors */
+TARGET_SSSE3
+void color2rgb888_n_ssse3(uint8_t *dst, const uint32_t *src, int n)
+{
+	const __m128i pack = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+	int i = 0;
+
+	for (; i + 16 <= n; i += 16) {
+		__m128i p0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (src + i)), pack);
+		__m128i p1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (src + i + 4)), pack);
+		__m128i p2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (src + i + 8)), pack);
+		__m128i p3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (src + i + 12)), pack);
+		uint8_t *d = dst + i * 3;
+
+		_mm_storeu_si128((__m128i *) (d +  0), _mm_or_si128(p0, _mm_slli_si128(p1, 12)));
+		_mm_storeu_si128((__m128i *) (d + 16), _mm_or_si128(_mm_srli_si128(p1, 4), _mm_slli_si128(p2, 8)));
+		_mm_storeu_si128((__m128i *) (d + 32), _mm_or_si128(_mm_srli_si128(p2, 8), _mm_slli_si128(p3, 4)));
+	}
+	color2rgb888_n_base(dst + i * 3, src + i, n - i);
+}
+
+TARGET_SSSE3
+void pixel2color_rgb888_n_ssse3(uint32_t *dst, const uint8_t *src, int n)
+{
+	const __m128i expand = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+	int i = 0;
+
+	for (; i + 16 <= n; i += 16) {
+		const uint8_t *s = src + i * 3;
+		__m128i v0 = _mm_loadu_si128((const __m128i *) (s +  0));
+		__m128i v1 = _mm_loadu_si128((const __m128i *) (s + 16));
+		__m128i v2 = _mm_loadu_si128((const __m128i *) (s + 32));
+
+		/* 12 bytes group at head of each vector */
+		_mm_storeu_si128((__m128i *) (dst + i),      _mm_shuffle_epi8(v0, expand));
+		_mm_storeu_si128((__m128i *) (dst + i + 4),  _mm_shuffle_epi8(_mm_alignr_epi8(v1, v0, 12), expand));
+		_mm_storeu_si128((__m128i *) (dst + i + 8),  _mm_shuffle_epi8(_mm_alignr_epi8(v2, v1, 8), expand));
+		_mm_storeu_si128((__m128i *) (dst + i + 12), _mm_shuffle_epi8(_mm_srli_si128(v2, 4), expand));
+	}
+	pixel2color_rgb888_n_base(dst + i, src + i * 3, n - i);
+}
+
+TARGET_AVX2
+void color2xrgb8888_n_avx2(uint8_t *dst, const uint32_t *src, int n)
+{
+	const __m256i mask = _mm256_set1_epi32(0xFFFFFF);
+	int i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		__m256i c = _mm256_loadu_si256((const __m256i *) (src + i));
+		_mm256_storeu_si256((__m256i *) (dst + i * 4), _mm256_and_si256(c, mask));
+	}
+	_mm256_zeroupper();
+	color2xrgb8888_n_base(dst + i * 4, src + i, n - i);
+}
+
+TARGET_AVX2
+void color2xbgr8888_n_avx2(uint8_t *dst, const uint32_t *src, int n)
+{
+	const __m256i mask_g = _mm256_set1_epi32(0x00FF00);
+	const __m256i mask_b = _mm256_set1_epi32(0x0000FF);
+	int i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		__m256i c = _mm256_loadu_si256((const __m256i *) (src + i));
+		__m256i p = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(c, 16), mask_b),
+			_mm256_or_si256(_mm256_and_si256(c, mask_g),
+			_mm256_slli_epi32(_mm256_and_si256(c, mask_b), 16)));
+		_mm256_storeu_si256((__m256i *) (dst + i * 4), p);
+	}
+	_mm256_zeroupper();
+	color2xbgr8888_n_base(dst + i * 4, src + i, n - i);
+}
+
+TARGET_AVX2
+static inline __m256i pack256_epi32_epi16(__m256i lo, __m256i hi)
+{
+	lo = _mm256_srai_epi32(_mm256_slli_epi32(lo, 16), 16);
+	hi = _mm256_srai_epi32(_mm256_slli_epi32(hi, 16), 16);
+	/* packs works in each 128bit lane: fix order of 64bit elements */
+	return _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xD8);
+}
+
+TARGET_AVX2
+static inline __m256i pack256_rgb16(__m256i c, int r_shift, int g_shift, int b_shift,
+	__m256i r_mask, __m256i g_mask, __m256i b_mask)
+{
+	return _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(c, r_shift), r_mask),
+		_mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(c, g_shift), g_mask),
+		_mm256_and_si256(_mm256_srli_epi32(c, b_shift), b_mask)));
+}
+
+TARGET_AVX2
+static inline __m256i dither256_add_epi32(__m256i c, __m256i t, int shift0, __m256i mask0, int shift1, __m256i mask1)
+{
+	__m256i scale = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(c, shift0), mask0),
+		_mm256_and_si256(_mm256_srli_epi32(c, shift1), mask1));
+	return _mm256_add_epi32(_mm256_sub_epi32(c, scale), t);
+}
+
+/* return number of converted pixels (multiple of 16) */
+TARGET_AVX2
+static inline int color2rgb16_n_avx2(uint8_t *dst, const uint32_t *src, int n,
+	int r_shift, int g_shift, uint32_t r_mask, uint32_t g_mask,
+	const uint32_t *threshold, uint32_t scale5, uint32_t scale6)
+{
+	const __m256i r256 = _mm256_set1_epi32(r_mask);
+	const __m256i g256 = _mm256_set1_epi32(g_mask);
+	const __m256i b256 = _mm256_set1_epi32(0x001F);
+	const __m256i s5 = _mm256_set1_epi32(scale5), s6 = _mm256_set1_epi32(scale6);
+	__m256i t = _mm256_setzero_si256();
+	int i = 0;
+
+	if (threshold)
+		t = _mm256_loadu_si256((const __m256i *) threshold);
+	for (; i + 16 <= n; i += 16) {
+		__m256i lo = _mm256_loadu_si256((const __m256i *) (src + i));
+		__m256i hi = _mm256_loadu_si256((const __m256i *) (src + i + 8));
+		if (threshold) {
+			lo = dither256_add_epi32(lo, t, 5, s5, 6, s6);
+			hi = dither256_add_epi32(hi, t, 5, s5, 6, s6);
+		}
+		lo = pack256_rgb16(lo, r_shift, g_shift, 3, r256, g256, b256);
+		hi = pack256_rgb16(hi, r_shift, g_shift, 3, r256, g256, b256);
+		_mm256_storeu_si256((__m256i *) (dst + i * 2), pack256_epi32_epi16(lo, hi));
+	}
+	return i;
+}
+
+TARGET_AVX2
+void color2rgb565_n_avx2(uint8_t *dst, const uint32_t *src, int n)
+{
+	int i = color2rgb16_n_avx2(dst, src, n, 8, 5, 0xF800, 0x07E0, NULL, 0, 0);
+
+	_mm256_zeroupper();
+	color2rgb565_n_base(dst + i * 2, src + i, n - i);
+}
+
+TARGET_AVX2
+void color2rgb555_n_avx2(uint8_t *dst, const uint32_t *src, int n)
+{
+	int i = color2rgb16_n_avx2(dst, src, n, 9, 6, 0x7C00, 0x03E0, NULL, 0, 0);
+
+	_mm256_zeroupper();
+	color2rgb555_n_base(dst + i * 2, src + i, n - i);
+}
+
+/* i is multiple of 16: threshold of tail starts at same phase */
+TARGET_AVX2
+void color2rgb565_dither_n_avx2(uint8_t *dst, const uint32_t *src, int n, const uint32_t *threshold)
+{
+	int i = color2rgb16_n_avx2(dst, src, n, 8, 5, 0xF800, 0x07E0, threshold, 0x070007, 0x000300);
+
+	_mm256_zeroupper();
+	color2rgb565_dither_n_base(dst + i * 2, src + i, n - i, threshold);
+}
+
+TARGET_AVX2
+void color2rgb555_dither_n_avx2(uint8_t *dst, const uint32_t *src, int n, const uint32_t *threshold)
+{
+	int i = color2rgb16_n_avx2(dst, src, n, 9, 6, 0x7C00, 0x03E0, threshold, 0x070707, 0);
+
+	_mm256_zeroupper();
+	color2rgb555_dither_n_base(dst + i * 2, src + i, n - i, threshold);
+}
+
+TARGET_AVX2
+static inline __m256i expand256_rgb16(__m256i p, int r_shift, int g_shift, int g_length)
+{
+	const __m256i mask5 = _mm256_set1_epi32(0x1F);
+	const __m256i maskg = _mm256_set1_epi32((1 << g_length) - 1);
+	__m256i r, g, b;
+
+	r = _mm256_and_si256(_mm256_srli_epi32(p, r_shift), mask5);
+	g = _mm256_and_si256(_mm256_srli_epi32(p, g_shift), maskg);
+	b = _mm256_and_si256(p, mask5);
+
+	r = _mm256_or_si256(_mm256_slli_epi32(r, 3), _mm256_srli_epi32(r, 2));
+	g = (g_length == 6) ? _mm256_or_si256(_mm256_slli_epi32(g, 2), _mm256_srli_epi32(g, 4))
+		: _mm256_or_si256(_mm256_slli_epi32(g, 3), _mm256_srli_epi32(g, 2));
+	b = _mm256_or_si256(_mm256_slli_epi32(b, 3), _mm256_srli_epi32(b, 2));
+
+	return _mm256_or_si256(_mm256_slli_epi32(r, 16), _mm256_or_si256(_mm256_slli_epi32(g, 8), b));
+}
+
+/* return number of converted pixels (multiple of 16) */
+TARGET_AVX2
+static inline int pixel2color_rgb16_n_avx2(uint32_t *dst, const uint8_t *src, int n, int r_shift, int g_length)
+{
+	int i = 0;
+
+	for (; i + 16 <= n; i += 16) {
+		/* zero extend 16 pixels in order (no lane crossing after cvt) */
+		__m256i lo = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *) (src + i * 2)));
+		__m256i hi = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *) (src + i * 2 + 16)));
+		_mm256_storeu_si256((__m256i *) (dst + i), expand256_rgb16(lo, r_shift, 5, g_length));
+		_mm256_storeu_si256((__m256i *) (dst + i + 8), expand256_rgb16(hi, r_shift, 5, g_length));
+	}
+	return i;
+}
+
+TARGET_AVX2
+void pixel2color_rgb565_n_avx2(uint32_t *dst, const uint8_t *src, int n)
+{
+	int i = pixel2color_rgb16_n_avx2(dst, src, n, 11, 6);
+
+	_mm256_zeroupper();
+	pixel2color_rgb565_n_base(dst + i, src + i * 2, n - i);
+}
+
+TARGET_AVX2
+void pixel2color_rgb555_n_avx2(uint32_t *dst, const uint8_t *src, int n)
+{
+	int i = pixel2color_rgb16_n_avx2(dst, src, n, 10, 5);
+
+	_mm256_zeroupper();
+	pixel2color_rgb555_n_base(dst + i, src + i * 2, n - i);
+}
+#endif
+
+/* kernels for running cpu (selected by pixel_dispatch()) */
+struct pixel_kernels_t {
+	void (*color2xrgb8888_n)(uint8_t *dst, const uint32_t *src, int n);
+	void (*color2xbgr8888_n)(uint8_t *dst, const uint32_t *src, int n);
+	void (*color2rgb888_n)(uint8_t *dst, const uint32_t *src, int n);
+	void (*color2rgb565_n)(uint8_t *dst, const uint32_t *src, int n);
+	void (*color2rgb555_n)(uint8_t *dst, const uint32_t *src, int n);
+	void (*color2rgb565_dither_n)(uint8_t *dst, const uint32_t *src, int n, const uint32_t *threshold);
+	void (*color2rgb555_dither_n)(uint8_t *dst, const uint32_t *src, int n, const uint32_t *threshold);
+	void (*pixel2color_rgb565_n)(uint32_t *dst, const uint8_t *src, int n);
+	void (*pixel2color_rgb555_n)(uint32_t *dst, const uint8_t *src, int n);
+	void (*pixel2color_rgb888_n)(uint32_t *dst, const uint8_t *src, int n);
+} pixel_kernels = {
+	.color2xrgb8888_n     = color2xrgb8888_n_base,
+	.color2xbgr8888_n     = color2xbgr8888_n_base,
+	.color2rgb888_n       = color2rgb888_n_base,
+	.color2rgb565_n       = color2rgb565_n_base,
+	.color2rgb555_n       = color2rgb555_n_base,
+	.color2rgb565_dither_n = color2rgb565_dither_n_base,
+	.color2rgb555_dither_n = color2rgb555_dither_n_base,
+	.pixel2color_rgb565_n = pixel2color_rgb565_n_base,
+	.pixel2color_rgb555_n = pixel2color_rgb555_n_base,
+	.pixel2color_rgb888_n = pixel2color_rgb888_n_base,
+};
+
+void pixel_dispatch(enum cpu_level level)
+{
+	pixel_kernels.color2xrgb8888_n     = color2xrgb8888_n_base;
+	pixel_kernels.color2xbgr8888_n     = color2xbgr8888_n_base;
+	pixel_kernels.color2rgb888_n       = color2rgb888_n_base;
+	pixel_kernels.color2rgb565_n       = color2rgb565_n_base;
+	pixel_kernels.color2rgb555_n       = color2rgb555_n_base;
+	pixel_kernels.color2rgb565_dither_n = color2rgb565_dither_n_base;
+	pixel_kernels.color2rgb555_dither_n = color2rgb555_dither_n_base;
+	pixel_kernels.pixel2color_rgb565_n = pixel2color_rgb565_n_base;
+	pixel_kernels.pixel2color_rgb555_n = pixel2color_rgb555_n_base;
+	pixel_kernels.pixel2color_rgb888_n = pixel2color_rgb888_n_base;
+
+#if defined(CPU_DISPATCH)
+	if (level >= CPU_SSSE3) {
+		pixel_kernels.color2rgb888_n       = color2rgb888_n_ssse3;
+		pixel_kernels.pixel2color_rgb888_n = pixel2color_rgb888_n_ssse3;
+	}
+	if (level >= CPU_AVX2) {
+		pixel_kernels.color2xrgb8888_n     = color2xrgb8888_n_avx2;
+		pixel_kernels.color2xbgr8888_n     = color2xbgr8888_n_avx2;
+		pixel_kernels.color2rgb565_n       = color2rgb565_n_avx2;
+		pixel_kernels.color2rgb555_n       = color2rgb555_n_avx2;
+		pixel_kernels.color2rgb565_dither_n = color2rgb565_dither_n_avx2;
+		pixel_kernels.color2rgb555_dither_n = color2rgb555_dither_n_avx2;
+		pixel_kernels.pixel2color_rgb565_n = pixel2color_rgb565_n_avx2;
+		pixel_kernels.pixel2color_rgb555_n = pixel2color_rgb555_n_avx2;
+	}
+#else
+	(void) level;
+#endif
+}
+
+void color2xrgb8888_n(uint8_t *dst, const uint32_t *src, int n)
+{
+	pixel_kernels.color2xrgb8888_n(dst, src, n);
+}
+
+void color2xbgr8888_n(uint8_t *dst, const uint32_t *src, int n)
+{
+	pixel_kernels.color2xbgr8888_n(dst, src, n);
+}
+
+void color2rgb888_n(uint8_t *dst, const uint32_t *src, int n)
+{
+	pixel_kernels.color2rgb888_n(dst, src, n);
+}
+
+void color2rgb565_n(uint8_t *dst, const uint32_t *src, int n)
+{
+	pixel_kernels.color2rgb565_n(dst, src, n);
+}
+
+void color2rgb555_n(uint8_t *dst, const uint32_t *src, int n)
+{
+	pixel_kernels.color2rgb555_n(dst, src, n);
+}
+
+void pixel2color_rgb565_n(uint32_t *dst, const uint8_t *src, int n)
+{
+	pixel_kernels.pixel2color_rgb565_n(dst, src, n);
+}
+
+void pixel2color_rgb555_n(uint32_t *dst, const uint8_t *src, int n)
+{
+	pixel_kernels.pixel2color_rgb555_n(dst, src, n);
+}
+
+void pixel2color_rgb888_n(uint32_t *dst, const uint8_t *src, int n)
+{
+	pixel_kernels.pixel2color_rgb888_n(dst, src, n);
+}
+
+void color2rgb332_n(uint8_t *dst, const uint32_t *src, int n)
+{
+	color2rgb8_n(dst, src, n, NULL);
+}
+
+void color2pixel_generic_n(struct fb_info_t *info, uint8_t *dst, const uint32_t *src, int n)
+{
+	for (int i = 0; i < n; i++)
+		store_pixel(dst + i * info->bytes_per_pixel,
+			color2pixel_generic(info, src[i]), info->bytes_per_pixel);
+}
+
+/* convert n colors into framebuffer pixels (dst must have n * bytes_per_pixel bytes) */
+void color2pixel_n(struct fb_info_t *info, uint8_t *dst, const uint32_t *src, int n)
+{
+	switch (info->format) {
+	case YAFT_FB_FORMAT_XRGB8888:
+		color2xrgb8888_n(dst, src, n);
+		break;
+	case YAFT_FB_FORMAT_XBGR8888:
+		color2xbgr8888_n(dst, src, n);
+		break;
+	case YAFT_FB_FORMAT_RGB888:
+		color2rgb888_n(dst, src, n);
+		break;
+	case YAFT_FB_FORMAT_RGB565:
+		color2rgb565_n(dst, src, n);
+		break;
+	case YAFT_FB_FORMAT_RGB555:
+		color2rgb555_n(dst, src, n);
+		break;
+	case YAFT_FB_FORMAT_RGB332:
+		color2rgb332_n(dst, src, n);
+		break;
+	default:
+		color2pixel_generic_n(info, dst, src, n);
+		break;
+	}
+}
+
+/* color2pixel_n() with ordered dithering: threshold is dither row of dst (see dither.h)
+	formats without dither kernel (and threshold == NULL) are converted by color2pixel_n() */
+void color2pixel_dither_n(struct fb_info_t *info, uint8_t *dst, const uint32_t *src, int n,
+	const uint32_t *threshold)
+{
+	if (!threshold) {
+		color2pixel_n(info, dst, src, n);
+		return;
+	}
+
+	switch (info->format) {
+	case YAFT_FB_FORMAT_RGB565:
+		pixel_kernels.color2rgb565_dither_n(dst, src, n, threshold);
+		break;
+	case YAFT_FB_FORMAT_RGB555:
+		pixel_kernels.color2rgb555_dither_n(dst, src, n, threshold);
+		break;
+	case YAFT_FB_FORMAT_RGB332:
+		color2rgb8_n(dst, src, n, threshold);
+		break;
+	default:
+		color2pixel_n(info, dst, src, n);
+		break;
+	}
+}
+
+void pixel2color_rgb332_n(uint32_t *dst, const uint8_t *src, int n)
+{
+	for (int i = 0; i < n; i++)
+		dst[i] = pixel2color_rgb332(src[i]);
+}
+
+void pixel2color_generic_n(struct fb_info_t *info, uint32_t *dst, const uint8_t *src, int n)
+{
+	for (int i = 0; i < n; i++)
+		dst[i] = pixel2color_generic(info, load_pixel(src + i * info->bytes_per_pixel, info->bytes_per_pixel));
+}
+
+/* return false if format is not known (YAFT_FB_FORMAT_GENERIC) */
+bool pixel2color_n(enum fb_format format, uint32_t *dst, const uint8_t *src, int n)
+{
+	switch (format) {
+	case YAFT_FB_FORMAT_XRGB8888:
+		/* (src & 0xFFFFFF) */
+		color2xrgb8888_n((uint8_t *) dst, (const uint32_t *) src, n);
+		break;
+	case YAFT_FB_FORMAT_XBGR8888:
+		/* swap of red and blue is symmetric */
+		color2xbgr8888_n((uint8_t *) dst, (const uint32_t *) src, n);
+		break;
+	case YAFT_FB_FORMAT_RGB888:
+		pixel2color_rgb888_n(dst, src, n);
+		break;
+	case YAFT_FB_FORMAT_RGB565:
+		pixel2color_rgb565_n(dst, src, n);
+		break;
+	case YAFT_FB_FORMAT_RGB555:
+		pixel2color_rgb555_n(dst, src, n);
+		break;
+	case YAFT_FB_FORMAT_RGB332:
+		pixel2color_rgb332_n(dst, src, n);
+		break;
+	default:
+		return false;
+	}
+	return true;
+}
+
+int format_bytes_per_pixel(enum fb_format format)
+{
+	switch (format) {
+	case YAFT_FB_FORMAT_XRGB8888:
+	case YAFT_FB_FORMAT_XBGR8888:
+		return 4;
+	case YAFT_FB_FORMAT_RGB888:
+		return 3;
+	case YAFT_FB_FORMAT_RGB565:
+	case YAFT_FB_FORMAT_RGB555:
+		return 2;
+	case YAFT_FB_FORMAT_RGB332:
+		return 1;
+	default:
+		return 0;
+	}
+}
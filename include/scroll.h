@@ -0,0 +1,161 @@
+/* See LICENSE for licence details. */
+/* hardware scrolling: visible window moves through virtual screen (yres_virtual) as ring buffer
+	scroll is a pan (no copy), at the end of virtual screen remaining lines are copied
+	to the other end at once (wrap)
+	without panning (or with shadow buffer / page flipping), scroll is memmove of fb->buf */
+enum scroll_misc {
+	SCROLL_MAX_PAGES = 3, /* size of ring (screens) */
+	SCROLL_MIN_PAGES = 2, /* wrap copy never overwrites visible window */
+};
+
+/* show top of virtual screen and restore original virtual resolution */
+void scroll_restore(struct framebuffer_t *fb)
+{
+	stats_ioctl(fb, STATS_IOCTL_PAN);
+	fb->backend->pan_display(fb->fd, &fb->info, 0);
+	flip_set_height_virtual(fb, fb->scroll.height_virtual);
+
+	fb->scroll.enabled = false;
+	fb->scroll.offset  = 0;
+	fb->buf = fb->fp;
+
+	flip_remap(fb, fb->info.screen_size);
+}
+
+void fb_scroll_die(struct framebuffer_t *fb)
+{
+	if (!fb->scroll.enabled)
+		return;
+
+	scroll_restore(fb);
+}
+
+/* exposed lines are filled by color */
+void scroll_memmove(struct framebuffer_t *fb, int lines, uint32_t color)
+{
+	struct fb_info_t *info = &fb->info;
+	size_t size = (size_t) (info->height - abs(lines)) * info->line_length;
+
+	stats_vram(fb, size);
+
+	if (lines > 0) {
+		memmove(fb->buf, fb->buf + (long) lines * info->line_length, size);
+		fb_fill_rect(fb, 0, info->height - lines, info->width, lines, color);
+	} else {
+		memmove(fb->buf + (long) -lines * info->line_length, fb->buf, size);
+		fb_fill_rect(fb, 0, 0, info->width, -lines, color);
+	}
+	fb_damage_all(fb);
+}
+
+/* lines > 0: scroll up (contents move up), lines < 0: scroll down */
+void fb_scroll(struct framebuffer_t *fb, int lines, uint32_t color)
+{
+	struct fb_info_t *info = &fb->info;
+	struct fb_scroll_t *scroll = &fb->scroll;
+	int offset, keep;
+
+	if (lines == 0)
+		return;
+
+	if (abs(lines) >= info->height) {
+		fb_fill_rect(fb, 0, 0, info->width, info->height, color);
+		return;
+	}
+
+	if (!scroll->enabled || (lines % info->ypanstep) != 0) {
+		scroll_memmove(fb, lines, color);
+		return;
+	}
+
+	offset = scroll->offset + lines;
+	keep   = info->height - abs(lines);
+
+	/* wrap: copy lines still visible to the other end of ring (outside of visible window) */
+	if (offset < 0 || offset + info->height > info->height_virtual) {
+		stats_vram(fb, (long) keep * info->line_length);
+		if (lines > 0) {
+			offset = 0;
+			stream_copy(fb->fp, fb->buf + (long) lines * info->line_length, (size_t) keep * info->line_length);
+		} else {
+			offset = (info->height_virtual - info->height) / info->ypanstep * info->ypanstep;
+			stream_copy(fb->fp + (long) (offset - lines) * info->line_length, fb->buf, (size_t) keep * info->line_length);
+		}
+	}
+
+	/* draw exposed lines before showing them */
+	fb->buf = fb->fp + (long) offset * info->line_length;
+	if (lines > 0)
+		fb_fill_rect(fb, 0, keep, info->width, lines, color);
+	else
+		fb_fill_rect(fb, 0, 0, info->width, -lines, color);
+
+	/* give up hardware scrolling: move scrolled window to top of virtual screen and show it */
+	stats_ioctl(fb, STATS_IOCTL_PAN);
+	if (!fb->backend->pan_display(fb->fd, info, offset)) {
+		logging(WARN, "scroll: pan failed, fallback to memmove\n");
+		stats_vram(fb, (long) info->height * info->line_length);
+		memmove(fb->fp, fb->buf, (size_t) info->height * info->line_length);
+		scroll_restore(fb);
+		return;
+	}
+	scroll->offset = offset;
+}
+
+/* return false (and scroll by memmove) if driver doesn't support panning */
+bool fb_scroll_init(struct framebuffer_t *fb)
+{
+	struct fb_info_t *info = &fb->info;
+	struct fb_scroll_t *scroll = &fb->scroll;
+
+	if (scroll->enabled)
+		return true;
+
+	if (fb->shadow || fb->flip.pages > 1) {
+		logging(WARN, "scroll: couldn't pan with shadow buffer or page flipping\n");
+		return false;
+	}
+
+	if (info->ypanstep == 0 || (info->height % info->ypanstep) != 0) {
+		logging(WARN, "scroll: panning not supported (ypanstep:%d)\n", info->ypanstep);
+		return false;
+	}
+
+	scroll->height_virtual = info->height_virtual;
+
+	/* use larger ring if possible: wrap copy occurs once per (pages - 1) screens */
+	for (int pages = SCROLL_MAX_PAGES; info->height_virtual < info->height * SCROLL_MIN_PAGES; pages--) {
+		if (pages < SCROLL_MIN_PAGES) {
+			logging(WARN, "scroll: couldn't allocate virtual screen\n");
+			return false;
+		}
+		if (flip_set_height_virtual(fb, info->height * pages)
+			&& info->virtual_size >= info->screen_size * pages)
+			break;
+		flip_set_height_virtual(fb, scroll->height_virtual);
+	}
+
+	if (info->virtual_size < (long) info->line_length * info->height_virtual) {
+		logging(WARN, "scroll: framebuffer memory is too small\n");
+		flip_set_height_virtual(fb, scroll->height_virtual);
+		return false;
+	}
+
+	if (!flip_remap(fb, info->virtual_size)) {
+		flip_set_height_virtual(fb, scroll->height_virtual);
+		return false;
+	}
+
+	stats_ioctl(fb, STATS_IOCTL_PAN);
+	if (!fb->backend->pan_display(fb->fd, info, 0)) {
+		logging(WARN, "scroll: pan failed\n");
+		scroll_restore(fb);
+		return false;
+	}
+
+	scroll->enabled = true;
+	scroll->offset  = 0;
+	fb->buf = fb->fp;
+
+	return true;
+}
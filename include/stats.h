@@ -0,0 +1,71 @@
+/* See LICENSE for licence details. */
+/* instrumentation: counters, latency histograms and init phase timings in fb->stats
+	updated by calling thread of fb_* functions (not by worker threads of pool), no locking
+	build with -DYAFB_NO_STATS to remove them: STATS is false and updates are dead code */
+static inline void stats_add(uint64_t *counter, uint64_t n)
+{
+	if (STATS)
+		*counter += n;
+}
+
+/* bytes written to fb->buf are counted only if it is framebuffer memory */
+static inline void stats_vram(struct framebuffer_t *fb, long size)
+{
+	if (STATS && buf_is_device(fb))
+		fb->stats.vram_bytes += size;
+}
+
+static inline void stats_ioctl(struct framebuffer_t *fb, enum fb_stats_ioctl type)
+{
+	if (STATS)
+		fb->stats.ioctls[type]++;
+}
+
+static inline int64_t stats_clock(void)
+{
+	return STATS ? now_nsec(): 0;
+}
+
+/* add time since start to log2 histogram of usec */
+static inline void stats_hist(unsigned long *hist, int64_t start)
+{
+	int64_t usec;
+	int i;
+
+	if (!STATS)
+		return;
+
+	usec = (now_nsec() - start) / 1000;
+	for (i = 0; usec > 1 && i < STATS_HIST_BUCKETS - 1; i++)
+		usec >>= 1;
+	hist[i]++;
+}
+
+/* record time of fb_open() phase since start: return start of next phase */
+static inline int64_t stats_phase(struct framebuffer_t *fb, enum fb_stats_phase phase, int64_t start)
+{
+	int64_t now;
+
+	if (!STATS)
+		return 0;
+
+	now = now_nsec();
+	fb->stats.init_phase[phase] = now - start;
+	return now;
+}
+
+/* copy of current values (all zero if built with YAFB_NO_STATS) */
+void fb_stats_snapshot(struct framebuffer_t *fb, struct fb_stats_t *stats)
+{
+	*stats = fb->stats;
+}
+
+/* clear counters and histograms (init phase timings are kept) */
+void fb_stats_reset(struct framebuffer_t *fb)
+{
+	int64_t init_phase[STATS_PHASE_NUM];
+
+	memcpy(init_phase, fb->stats.init_phase, sizeof(init_phase));
+	memset(&fb->stats, 0, sizeof(struct fb_stats_t));
+	memcpy(fb->stats.init_phase, init_phase, sizeof(init_phase));
+}
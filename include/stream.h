@@ -0,0 +1,218 @@
+/* See LICENSE for licence details. */
+/* streaming copy: non-temporal stores (movnti/movntdq/vmovntdq) for framebuffer memory
+	(write-combined or uncached): written lines bypass cache and are not read before write
+	unaligned head/tail of dst are written by movnti (4 bytes) and plain stores (< 4 bytes)
+	readback (stream_read) uses non-temporal loads (vmovntdqa, AVX2 or later) from aligned framebuffer memory
+	kernel is selected at runtime by stream_dispatch() (cpu level and YAFB_STREAM env), fallback is memcpy */
+
+enum stream_misc {
+	STREAM_MIN_SIZE = 256, /* byte: smaller copy uses memcpy */
+};
+
+enum stream_mode {
+	STREAM_NONE = 0,
+	STREAM_SSE2,
+	STREAM_AVX2,
+	STREAM_AVX512,
+};
+
+const char *stream_mode_str[] = {
+	[STREAM_NONE] = "none",
+	[STREAM_SSE2] = "sse2",
+	[STREAM_AVX2] = "avx2",
+	[STREAM_AVX512] = "avx512",
+};
+
+enum stream_mode stream_mode = STREAM_NONE;
+
+#if defined(CPU_DISPATCH)
+/* copy until dst is aligned (align: 16, 32 or 64), return copied bytes */
+__attribute__((target("sse2")))
+static inline size_t stream_head(uint8_t *dst, const uint8_t *src, size_t size, size_t align)
+{
+	size_t head = (-(uintptr_t) dst) & (align - 1), i = 0;
+	int32_t word;
+
+	if (head > size)
+		head = size;
+
+	for (; i < head && ((uintptr_t) (dst + i) & 3); i++)
+		dst[i] = src[i];
+	for (; i + 4 <= head; i += 4) {
+		memcpy(&word, src + i, 4);
+		_mm_stream_si32((int *) (dst + i), word);
+	}
+	for (; i < head; i++)
+		dst[i] = src[i];
+
+	return head;
+}
+
+/* copy tail (dst is aligned) */
+__attribute__((target("sse2")))
+static inline void stream_tail(uint8_t *dst, const uint8_t *src, size_t size)
+{
+	size_t i = 0;
+	int32_t word;
+
+	for (; i + 4 <= size; i += 4) {
+		memcpy(&word, src + i, 4);
+		_mm_stream_si32((int *) (dst + i), word);
+	}
+	for (; i < size; i++)
+		dst[i] = src[i];
+}
+
+__attribute__((target("sse2")))
+void stream_copy_sse2(uint8_t *dst, const uint8_t *src, size_t size)
+{
+	size_t i = stream_head(dst, src, size, 16);
+
+	for (; i + 64 <= size; i += 64) {
+		__m128i v0 = _mm_loadu_si128((const __m128i *) (src + i +  0));
+		__m128i v1 = _mm_loadu_si128((const __m128i *) (src + i + 16));
+		__m128i v2 = _mm_loadu_si128((const __m128i *) (src + i + 32));
+		__m128i v3 = _mm_loadu_si128((const __m128i *) (src + i + 48));
+		_mm_stream_si128((__m128i *) (dst + i +  0), v0);
+		_mm_stream_si128((__m128i *) (dst + i + 16), v1);
+		_mm_stream_si128((__m128i *) (dst + i + 32), v2);
+		_mm_stream_si128((__m128i *) (dst + i + 48), v3);
+	}
+	for (; i + 16 <= size; i += 16)
+		_mm_stream_si128((__m128i *) (dst + i), _mm_loadu_si128((const __m128i *) (src + i)));
+
+	stream_tail(dst + i, src + i, size - i);
+	_mm_sfence();
+}
+
+TARGET_AVX2
+void stream_copy_avx2(uint8_t *dst, const uint8_t *src, size_t size)
+{
+	size_t i = stream_head(dst, src, size, 32);
+
+	for (; i + 64 <= size; i += 64) {
+		__m256i v0 = _mm256_loadu_si256((const __m256i *) (src + i +  0));
+		__m256i v1 = _mm256_loadu_si256((const __m256i *) (src + i + 32));
+		_mm256_stream_si256((__m256i *) (dst + i +  0), v0);
+		_mm256_stream_si256((__m256i *) (dst + i + 32), v1);
+	}
+	for (; i + 32 <= size; i += 32)
+		_mm256_stream_si256((__m256i *) (dst + i), _mm256_loadu_si256((const __m256i *) (src + i)));
+
+	stream_tail(dst + i, src + i, size - i);
+	_mm_sfence();
+}
+
+TARGET_AVX512
+void stream_copy_avx512(uint8_t *dst, const uint8_t *src, size_t size)
+{
+	size_t i = stream_head(dst, src, size, 64);
+
+	for (; i + 64 <= size; i += 64)
+		_mm512_stream_si512((void *) (dst + i), _mm512_loadu_si512((const void *) (src + i)));
+
+	stream_tail(dst + i, src + i, size - i);
+	_mm_sfence();
+}
+
+/* streaming loads (vmovntdqa) from aligned src: on write-combined memory, each load fills a streaming buffer
+	of whole line instead of uncached access per load (cached memory: same as plain load) */
+TARGET_AVX2
+void stream_read_avx2(uint8_t *dst, const uint8_t *src, size_t size)
+{
+	size_t i = (-(uintptr_t) src) & 31;
+
+	if (i > size)
+		i = size;
+	memcpy(dst, src, i);
+
+	for (; i + 64 <= size; i += 64) {
+		__m256i v0 = _mm256_stream_load_si256((const __m256i *) (src + i +  0));
+		__m256i v1 = _mm256_stream_load_si256((const __m256i *) (src + i + 32));
+		_mm256_storeu_si256((__m256i *) (dst + i +  0), v0);
+		_mm256_storeu_si256((__m256i *) (dst + i + 32), v1);
+	}
+	memcpy(dst + i, src + i, size - i);
+}
+
+TARGET_AVX512
+void stream_read_avx512(uint8_t *dst, const uint8_t *src, size_t size)
+{
+	size_t i = (-(uintptr_t) src) & 63;
+
+	if (i > size)
+		i = size;
+	memcpy(dst, src, i);
+
+	for (; i + 64 <= size; i += 64)
+		_mm512_storeu_si512((void *) (dst + i), _mm512_stream_load_si512((void *) (src + i)));
+	memcpy(dst + i, src + i, size - i);
+}
+#endif
+
+/* copy to framebuffer memory: stores are globally visible (sfence) when returned */
+void stream_copy(uint8_t *dst, const uint8_t *src, size_t size)
+{
+#if defined(CPU_DISPATCH)
+	if (size >= STREAM_MIN_SIZE) {
+		if (stream_mode == STREAM_AVX512) {
+			stream_copy_avx512(dst, src, size);
+			return;
+		} else if (stream_mode == STREAM_AVX2) {
+			stream_copy_avx2(dst, src, size);
+			return;
+		} else if (stream_mode == STREAM_SSE2) {
+			stream_copy_sse2(dst, src, size);
+			return;
+		}
+	}
+#endif
+	memcpy(dst, src, size);
+}
+
+/* copy from framebuffer memory (screen readback): SSE2 has no streaming load (SSE4.1), uses memcpy */
+void stream_read(uint8_t *dst, const uint8_t *src, size_t size)
+{
+#if defined(CPU_DISPATCH)
+	if (size >= STREAM_MIN_SIZE) {
+		if (stream_mode == STREAM_AVX512) {
+			stream_read_avx512(dst, src, size);
+			return;
+		} else if (stream_mode == STREAM_AVX2) {
+			stream_read_avx2(dst, src, size);
+			return;
+		}
+	}
+#endif
+	memcpy(dst, src, size);
+}
+
+/* select kernel: YAFB_STREAM=0 disables streaming stores and loads */
+void stream_dispatch(enum cpu_level level)
+{
+	char *env;
+
+	stream_mode = STREAM_NONE;
+
+	if ((env = getenv("YAFB_STREAM")) != NULL && strcmp(env, "0") == 0)
+		return;
+
+#if defined(CPU_DISPATCH)
+	if (level >= CPU_AVX512)
+		stream_mode = STREAM_AVX512;
+	else if (level >= CPU_AVX2)
+		stream_mode = STREAM_AVX2;
+	else if (level >= CPU_SSE2)
+		stream_mode = STREAM_SSE2;
+#else
+	(void) level;
+#endif
+
+	logging(DEBUG, "streaming store: %s\n", stream_mode_str[stream_mode]);
+}
+
+/* drawing target is framebuffer memory (not shadow buffer): bulk writes should be streamed */
+static inline bool buf_is_device(struct framebuffer_t *fb)
+{
+	return fb->buf != fb->shadow;
+}
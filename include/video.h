@@ -0,0 +1,412 @@
+/* See LICENSE for licence details. */
+/* raw video playback: frames are read from mapped file (or pipe) and decoded into one of two slots by reader thread,
+	caller thread (writer) converts decoded frame into native pixels by fb_blit() (to fb->buf: framebuffer, back page
+	or shadow buffer) and presents it at target fps, while reader prepares next frame
+	formats: farbfeld/ppm (P6, maxval 255) stream of images (e.g. ffmpeg -f image2pipe), or headerless raw frames */
+enum video_misc {
+	VIDEO_SLOTS    = 2,
+	VIDEO_MAX_SIZE = 16384, /* pixels: width and height of frame */
+};
+
+struct video_slot_t {
+	uint8_t *buf;                  /* decoded frame (NULL: raw frame is read from mapped file directly) */
+	const uint8_t *frame;          /* first line of frame */
+	bool full;                     /* decoded by reader, not shown by writer yet */
+};
+
+struct fb_video_t {
+	enum fb_video_type type;
+	int fd;
+	const uint8_t *map;            /* mapped file (NULL: pipe, read by read(2)) */
+	size_t map_size, pos;
+	int width, height;
+	int stride;                    /* bytes per line of decoded frame */
+	enum fb_format format;         /* format of decoded frame */
+	uint8_t *input;                /* pipe: undecoded payload of farbfeld/ppm frame */
+	size_t input_size;
+	bool header_read;              /* header of first frame is read by fb_video_open() */
+	struct video_slot_t slots[VIDEO_SLOTS];
+	unsigned long next;            /* sequence number of next frame shown by writer */
+	pthread_t reader;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool eof, error, quit;
+};
+
+static inline uint32_t video_be32(const uint8_t *p)
+{
+	return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+/* next n bytes of input: pointer into mapped file, or read into buf (pipe): NULL at end of input */
+const uint8_t *video_input(struct fb_video_t *video, uint8_t *buf, size_t n)
+{
+	const uint8_t *ptr;
+	ssize_t size;
+
+	if (video->map) {
+		if (video->map_size - video->pos < n) {
+			video->pos = video->map_size;
+			return NULL;
+		}
+		ptr = video->map + video->pos;
+		video->pos += n;
+		return ptr;
+	}
+
+	for (size_t done = 0; done < n; done += size) {
+		errno = 0;
+		if ((size = read(video->fd, buf + done, n - done)) < 0 && errno == EINTR) {
+			size = 0;
+			continue;
+		}
+		if (size <= 0) {
+			if (size < 0)
+				logging(ERROR, "video: read: %s\n", strerror(errno));
+			return NULL;
+		}
+	}
+	return buf;
+}
+
+int video_getc(struct fb_video_t *video)
+{
+	uint8_t c;
+	const uint8_t *ptr = video_input(video, &c, 1);
+
+	return ptr ? *ptr: EOF;
+}
+
+/* decimal number of ppm header (after whitespace and comments), one whitespace after it is consumed: -1 if invalid */
+long ppm_number(struct fb_video_t *video)
+{
+	long value = 0;
+	int c;
+
+	while ((c = video_getc(video)) != EOF) {
+		if (c == '#') {
+			while ((c = video_getc(video)) != EOF && c != '\n');
+		} else if (!isspace(c)) {
+			break;
+		}
+	}
+
+	if (c == EOF || !isdigit(c))
+		return -1;
+
+	for (; c != EOF && isdigit(c); c = video_getc(video)) {
+		if ((value = value * 10 + (c - '0')) > VIDEO_MAX_SIZE)
+			return -1;
+	}
+	return value;
+}
+
+/* return false at end of input (video->error is set if header is invalid) */
+bool video_header(struct fb_video_t *video, int *width, int *height)
+{
+	uint8_t header[16];
+	const uint8_t *ptr;
+	long maxval;
+	int c;
+
+	if (video->type == VIDEO_FARBFELD) {
+		if ((ptr = video_input(video, header, sizeof(header))) == NULL)
+			return false;
+		if (memcmp(ptr, "farbfeld", 8) != 0) {
+			logging(ERROR, "video: invalid farbfeld header\n");
+			video->error = true;
+			return false;
+		}
+		*width  = video_be32(ptr + 8) > VIDEO_MAX_SIZE ? -1: (int) video_be32(ptr + 8);
+		*height = video_be32(ptr + 12) > VIDEO_MAX_SIZE ? -1: (int) video_be32(ptr + 12);
+	} else {
+		if ((c = video_getc(video)) == EOF)
+			return false;
+		if (c != 'P' || video_getc(video) != '6') {
+			logging(ERROR, "video: invalid ppm header (only P6 is supported)\n");
+			video->error = true;
+			return false;
+		}
+		*width  = ppm_number(video);
+		*height = ppm_number(video);
+		if ((maxval = ppm_number(video)) != 255) {
+			logging(ERROR, "video: ppm maxval %ld not supported (only 255)\n", maxval);
+			video->error = true;
+			return false;
+		}
+	}
+
+	if (*width <= 0 || *height <= 0) {
+		logging(ERROR, "video: invalid frame size %dx%d\n", *width, *height);
+		video->error = true;
+		return false;
+	}
+	return true;
+}
+
+/* fault in pages of mapped frame on reader thread, instead of writer */
+void video_touch(const uint8_t *ptr, size_t size)
+{
+	volatile uint8_t sum = 0;
+
+	for (size_t offset = 0; offset < size; offset += 4096)
+		sum += ptr[offset];
+	(void) sum;
+}
+
+/* decode next frame into slot: return false at end of input or error */
+bool video_decode(struct fb_video_t *video, struct video_slot_t *slot)
+{
+	const uint8_t *src;
+	uint32_t *dst;
+	size_t pixels = (size_t) video->width * video->height;
+	int width, height;
+
+	if (video->type == VIDEO_RAW) {
+		if ((src = video_input(video, slot->buf, (size_t) video->stride * video->height)) == NULL)
+			return false;
+		if (video->map)
+			video_touch(src, (size_t) video->stride * video->height);
+		slot->frame = src;
+		return true;
+	}
+
+	if (video->header_read) {
+		video->header_read = false;
+	} else {
+		if (!video_header(video, &width, &height))
+			return false;
+		if (width != video->width || height != video->height) {
+			logging(ERROR, "video: frame size changed %dx%d -> %dx%d\n", video->width, video->height, width, height);
+			video->error = true;
+			return false;
+		}
+	}
+
+	if ((src = video_input(video, video->input, video->input_size)) == NULL) {
+		logging(ERROR, "video: truncated frame\n");
+		video->error = true;
+		return false;
+	}
+
+	/* farbfeld: 16bit RGBA big endian (upper byte is used), ppm: 8bit RGB -> XRGB8888 */
+	dst = (uint32_t *) slot->buf;
+	if (video->type == VIDEO_FARBFELD) {
+		for (size_t i = 0; i < pixels; i++, src += 8)
+			dst[i] = ((uint32_t) src[0] << 16) | ((uint32_t) src[2] << 8) | src[4];
+	} else {
+		for (size_t i = 0; i < pixels; i++, src += 3)
+			dst[i] = ((uint32_t) src[0] << 16) | ((uint32_t) src[1] << 8) | src[2];
+	}
+	slot->frame = slot->buf;
+
+	return true;
+}
+
+void *video_reader(void *arg)
+{
+	struct fb_video_t *video = (struct fb_video_t *) arg;
+	struct video_slot_t *slot;
+	bool decoded;
+
+	for (unsigned long seq = 0; ; seq++) {
+		slot = &video->slots[seq % VIDEO_SLOTS];
+
+		/* wait until writer has shown previous frame of this slot */
+		pthread_mutex_lock(&video->lock);
+		while (slot->full && !video->quit)
+			pthread_cond_wait(&video->cond, &video->lock);
+		if (video->quit) {
+			pthread_mutex_unlock(&video->lock);
+			break;
+		}
+		pthread_mutex_unlock(&video->lock);
+
+		decoded = video_decode(video, slot);
+
+		pthread_mutex_lock(&video->lock);
+		if (decoded)
+			slot->full = true;
+		else
+			video->eof = true;
+		pthread_cond_broadcast(&video->cond);
+		pthread_mutex_unlock(&video->lock);
+
+		if (!decoded)
+			break;
+	}
+	return NULL;
+}
+
+void video_free(struct fb_video_t *video)
+{
+	for (int i = 0; i < VIDEO_SLOTS; i++)
+		free(video->slots[i].buf);
+	free(video->input);
+	if (video->map)
+		emunmap((void *) video->map, video->map_size);
+	if (video->fd != STDIN_FILENO)
+		eclose(video->fd);
+	free(video);
+}
+
+/* path: file or fifo ("-": stdin), regular file is mapped
+	farbfeld/ppm: frame size is taken from header of first frame (width/height/format are ignored)
+	raw: frames of width x height pixels in format (any format except YAFT_FB_FORMAT_GENERIC), without padding */
+struct fb_video_t *fb_video_open(const char *path, enum fb_video_type type, int width, int height, enum fb_format format)
+{
+	struct fb_video_t *video;
+	struct stat st;
+	size_t frame_size;
+	bool buffered;
+
+	if ((video = (struct fb_video_t *) ecalloc(1, sizeof(struct fb_video_t))) == NULL)
+		return NULL;
+
+	video->type = type;
+	if (strcmp(path, "-") == 0)
+		video->fd = STDIN_FILENO;
+	else if ((video->fd = eopen(path, O_RDONLY)) < 0)
+		goto open_failed;
+
+	/* regular file: decoded (or shown) from page cache without copy */
+	if (fstat(video->fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		video->map_size = st.st_size;
+		video->map = (const uint8_t *) emmap(0, video->map_size, PROT_READ, MAP_PRIVATE, video->fd, 0);
+		if (video->map == MAP_FAILED) {
+			video->map = NULL;
+			goto header_failed;
+		}
+#if defined(MADV_SEQUENTIAL)
+		madvise((void *) video->map, video->map_size, MADV_SEQUENTIAL);
+#endif
+	}
+
+	if (type == VIDEO_RAW) {
+		if (format_bytes_per_pixel(format) == 0 || width <= 0 || height <= 0
+			|| width > VIDEO_MAX_SIZE || height > VIDEO_MAX_SIZE) {
+			logging(ERROR, "video: invalid raw frame %dx%d (format:%d)\n", width, height, format);
+			goto header_failed;
+		}
+		video->format = format;
+		video->stride = width * format_bytes_per_pixel(format);
+		frame_size    = (size_t) video->stride * height;
+		buffered      = !video->map;
+	} else {
+		if (!video_header(video, &width, &height)) {
+			logging(ERROR, "video: couldn't read first frame of \"%s\"\n", path);
+			goto header_failed;
+		}
+		video->header_read = true;
+		video->format = YAFT_FB_FORMAT_XRGB8888;
+		video->stride = width * 4;
+		frame_size    = (size_t) video->stride * height;
+		buffered      = true;
+
+		video->input_size = (size_t) width * height * ((type == VIDEO_FARBFELD) ? 8: 3);
+		if (!video->map && (video->input = (uint8_t *) ecalloc(1, video->input_size)) == NULL)
+			goto header_failed;
+	}
+	video->width  = width;
+	video->height = height;
+
+	for (int i = 0; buffered && i < VIDEO_SLOTS; i++) {
+		if ((video->slots[i].buf = (uint8_t *) ecalloc(1, frame_size)) == NULL)
+			goto header_failed;
+	}
+
+	pthread_mutex_init(&video->lock, NULL);
+	pthread_cond_init(&video->cond, NULL);
+
+	if ((errno = pthread_create(&video->reader, NULL, video_reader, video)) != 0) {
+		logging(ERROR, "video: pthread_create: %s\n", strerror(errno));
+		pthread_cond_destroy(&video->cond);
+		pthread_mutex_destroy(&video->lock);
+		goto header_failed;
+	}
+	logging(DEBUG, "video: %dx%d %s\n", width, height, video->map ? "mapped": "pipe");
+
+	return video;
+
+header_failed:
+	video_free(video);
+	return NULL;
+open_failed:
+	free(video);
+	return NULL;
+}
+
+void video_sleep_until(int64_t deadline)
+{
+	struct timespec ts;
+
+	ts.tv_sec  = deadline / 1000000000;
+	ts.tv_nsec = deadline % 1000000000;
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+/* show frames at center of screen until end of input, paced to fps (<= 0: as fast as possible)
+	frame later than one interval is dropped (not converted) to keep pace: return false on input error */
+bool fb_video_play(struct framebuffer_t *fb, struct fb_video_t *video, int fps, struct fb_video_stats_t *stats)
+{
+	struct fb_video_stats_t count;
+	struct video_slot_t *slot;
+	int64_t interval = (fps > 0) ? 1000000000 / fps: 0, start = now_nsec(), deadline;
+	int x = (fb->info.width - video->width) / 2, y = (fb->info.height - video->height) / 2;
+	bool full;
+
+	memset(&count, 0, sizeof(struct fb_video_stats_t));
+
+	for (unsigned long seq = 0; ; seq++, video->next++) {
+		slot = &video->slots[video->next % VIDEO_SLOTS];
+
+		pthread_mutex_lock(&video->lock);
+		if (!slot->full && !video->eof)
+			count.starved++;
+		while (!slot->full && !video->eof)
+			pthread_cond_wait(&video->cond, &video->lock);
+		full = slot->full;
+		pthread_mutex_unlock(&video->lock);
+
+		if (!full)
+			break;
+
+		deadline = start + (int64_t) seq * interval;
+		if (interval > 0 && now_nsec() > deadline + interval) {
+			count.dropped++;
+		} else {
+			fb_blit(fb, x, y, slot->frame, video->stride, video->format, video->width, video->height);
+			if (interval > 0)
+				video_sleep_until(deadline);
+			fb_present(fb, false);
+			count.shown++;
+		}
+
+		/* give slot back to reader */
+		pthread_mutex_lock(&video->lock);
+		slot->full = false;
+		pthread_cond_broadcast(&video->cond);
+		pthread_mutex_unlock(&video->lock);
+	}
+
+	logging(DEBUG, "video: shown:%lu dropped:%lu starved:%lu\n", count.shown, count.dropped, count.starved);
+	if (stats)
+		*stats = count;
+
+	return !video->error;
+}
+
+void fb_video_close(struct fb_video_t *video)
+{
+	pthread_mutex_lock(&video->lock);
+	video->quit = true;
+	pthread_cond_broadcast(&video->cond);
+	pthread_mutex_unlock(&video->lock);
+
+	pthread_join(video->reader, NULL);
+
+	pthread_cond_destroy(&video->cond);
+	pthread_mutex_destroy(&video->lock);
+	video_free(video);
+}
@@ -0,0 +1,200 @@
+/* See LICENSE for licence details. */
+/* virtual backend: framebuffer on memory (memfd or unlinked tmpfile)
+	works without framebuffer device (benchmark/regression test on headless machine) */
+enum virtual_misc {
+	VIRTUAL_DEFAULT_WIDTH  = 640,
+	VIRTUAL_DEFAULT_HEIGHT = 480,
+	VIRTUAL_DEFAULT_DEPTH  = 32,
+	VIRTUAL_REFRESH_RATE   = 60,
+};
+
+/* read mode from YAFB_VIRTUAL_MODE env ("WIDTHxHEIGHTxBPP") */
+void virtual_default_mode(struct fb_info_t *mode)
+{
+	char *env;
+	int width, height, depth;
+
+	width  = VIRTUAL_DEFAULT_WIDTH;
+	height = VIRTUAL_DEFAULT_HEIGHT;
+	depth  = VIRTUAL_DEFAULT_DEPTH;
+
+	if ((env = getenv("YAFB_VIRTUAL_MODE")) != NULL
+		&& sscanf(env, "%dx%dx%d", &width, &height, &depth) != 3) {
+		logging(WARN, "invalid YAFB_VIRTUAL_MODE \"%s\", use default\n", env);
+		width  = VIRTUAL_DEFAULT_WIDTH;
+		height = VIRTUAL_DEFAULT_HEIGHT;
+		depth  = VIRTUAL_DEFAULT_DEPTH;
+	}
+
+	mode->width  = width;
+	mode->height = height;
+	mode->bits_per_pixel = depth;
+	mode->visual = (depth == 8) ? YAFT_FB_VISUAL_PSEUDOCOLOR: YAFT_FB_VISUAL_TRUECOLOR;
+}
+
+void virtual_set_bitfield(int depth, struct bitfield_t *red, struct bitfield_t *green, struct bitfield_t *blue)
+{
+	switch (depth) {
+	case 15:
+		red->offset = 10; green->offset = 5;  blue->offset = 0;
+		red->length = 5;  green->length = 5;  blue->length = 5;
+		break;
+	case 16:
+		red->offset = 11; green->offset = 5;  blue->offset = 0;
+		red->length = 5;  green->length = 6;  blue->length = 5;
+		break;
+	case 24:
+	case 32:
+		red->offset = 16; green->offset = 8;  blue->offset = 0;
+		red->length = 8;  green->length = 8;  blue->length = 8;
+		break;
+	default: /* 8bpp: fixed palette is set by init_indexcolor() */
+		break;
+	}
+}
+
+int virtual_open(const char *path)
+{
+	int fd;
+	char template[] = "/tmp/yafblib-XXXXXX";
+
+	(void) path;
+
+#if defined(SYS_memfd_create)
+	errno = 0;
+	if ((fd = syscall(SYS_memfd_create, "yafblib", 0)) >= 0)
+		return fd;
+	logging(WARN, "memfd_create: %s\n", strerror(errno));
+#endif
+
+	/* fallback: unlinked tmpfile */
+	errno = 0;
+	if ((fd = mkstemp(template)) < 0) {
+		logging(ERROR, "mkstemp: %s\n", strerror(errno));
+		return -1;
+	}
+	unlink(template);
+
+	return fd;
+}
+
+/* info already has requested mode (width/height/bits_per_pixel/bitfield/visual) */
+bool virtual_set_fbinfo(int fd, struct fb_info_t *info)
+{
+	errno = 0;
+
+	switch (info->bits_per_pixel) {
+	case 8:
+	case 15:
+	case 16:
+	case 24:
+	case 32:
+		break;
+	default:
+		logging(ERROR, "virtual %d bpp not supported\n", info->bits_per_pixel);
+		return false;
+	}
+
+	if (info->width <= 0 || info->height <= 0) {
+		logging(ERROR, "invalid virtual resolution %dx%d\n", info->width, info->height);
+		return false;
+	}
+
+	if (info->red.length == 0 && info->green.length == 0 && info->blue.length == 0)
+		virtual_set_bitfield(info->bits_per_pixel, &info->red, &info->green, &info->blue);
+
+	info->bytes_per_pixel = my_ceil(info->bits_per_pixel, BITS_PER_BYTE);
+
+	/* line_length larger than width is allowed (padding) */
+	if (info->line_length < info->width * info->bytes_per_pixel)
+		info->line_length = info->width * info->bytes_per_pixel;
+	info->memory_size = (long) info->line_length * info->height;
+
+	info->type = YAFT_FB_TYPE_PACKED_PIXELS;
+
+	info->height_virtual = info->height;
+	info->ypanstep       = 1;
+
+	if (ftruncate(fd, info->memory_size) < 0) {
+		logging(ERROR, "ftruncate: %s\n", strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
+/* palette of virtual framebuffer is not backed by hardware */
+int virtual_put_cmap(int fd, cmap_t *cmap)
+{
+	(void) fd;
+	(void) cmap;
+	return 0;
+}
+
+int virtual_put_cmap_range(int fd, cmap_t *cmap, int start, int len)
+{
+	(void) fd;
+	(void) cmap;
+	(void) start;
+	(void) len;
+	return 0;
+}
+
+int virtual_get_cmap(int fd, cmap_t *cmap)
+{
+	(void) fd;
+	(void) cmap;
+	return 0;
+}
+
+/* virtual screen is only limited by memory, panning shows nothing */
+bool virtual_set_height_virtual(int fd, struct fb_info_t *info, int height_virtual)
+{
+	errno = 0;
+
+	if (ftruncate(fd, (long) info->line_length * height_virtual) < 0) {
+		logging(ERROR, "ftruncate: %s\n", strerror(errno));
+		return false;
+	}
+	info->height_virtual = height_virtual;
+	info->memory_size    = (long) info->line_length * height_virtual;
+
+	return true;
+}
+
+bool virtual_pan_display(int fd, struct fb_info_t *info, int yoffset)
+{
+	(void) fd;
+
+	return yoffset >= 0 && yoffset + info->height <= info->height_virtual;
+}
+
+/* emulate vertical blank: sleep until next refresh boundary of monotonic clock */
+bool virtual_wait_vsync(int fd)
+{
+	const int64_t interval = 1000000000 / VIRTUAL_REFRESH_RATE;
+	int64_t next;
+	struct timespec ts;
+
+	(void) fd;
+
+	next = (now_nsec() / interval + 1) * interval;
+	ts.tv_sec  = next / 1000000000;
+	ts.tv_nsec = next % 1000000000;
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+
+	return true;
+}
+
+const struct fb_backend_t fb_backend_virtual = {
+	.name       = "virtual",
+	.open       = virtual_open,
+	.set_fbinfo = virtual_set_fbinfo,
+	.put_cmap   = virtual_put_cmap,
+	.put_cmap_range = virtual_put_cmap_range,
+	.get_cmap   = virtual_get_cmap,
+	.set_height_virtual = virtual_set_height_virtual,
+	.pan_display        = virtual_pan_display,
+	.wait_vsync         = virtual_wait_vsync,
+};
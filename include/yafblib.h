@@ -1,19 +1,33 @@
 /* See LICENSE for licence details. */
+#if !defined(_DEFAULT_SOURCE)
+	#define _DEFAULT_SOURCE /* syscall(2), mkstemp(3), ftruncate(2) in strict c99 */
+#endif
+
+#include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
 #include <unistd.h>
 
 enum misc {
 	VERBOSE       = false,
+#if defined(YAFB_NO_STATS)
+	STATS         = false, /* instrumentation is removed at compile time (see stats.h) */
+#else
+	STATS         = true,
+#endif
 	BITS_PER_BYTE = 8,
 	BITS_PER_RGB  = 8,
 };
@@ -46,19 +60,37 @@ enum fb_visual {
 	YAFT_FB_VISUAL_UNKNOWN,
 };
 
+enum fb_format {
+	YAFT_FB_FORMAT_GENERIC = 0,  /* any bitfields: converted by color2pixel_generic() */
+	YAFT_FB_FORMAT_XRGB8888,
+	YAFT_FB_FORMAT_XBGR8888,
+	YAFT_FB_FORMAT_RGB888,       /* 24bpp packed */
+	YAFT_FB_FORMAT_RGB565,
+	YAFT_FB_FORMAT_RGB555,
+	YAFT_FB_FORMAT_RGB332,       /* 8bpp pseudocolor fixed palette */
+};
+
 struct fb_info_t {
 	struct bitfield_t {
 		int length;
 		int offset;
 	} red, green, blue;
 	int width, height;       /* display resolution */
-	long screen_size;        /* screen data size (byte) */
+	long screen_size;        /* visible area: line_length * height (byte) */
+	long virtual_size;       /* virtual screen: line_length * height_virtual (byte), at most memory_size */
+	long memory_size;        /* framebuffer memory reported by backend (byte), may be much larger */
+	long mapped_size;        /* mapped from top of framebuffer memory (byte): visible area, or virtual screen
+	                            while page flipping/hardware scrolling is enabled */
 	int line_length;         /* line length (byte) */
+	int height_virtual;      /* virtual resolution (lines) */
+	int ypanstep;            /* 0: panning not supported */
 	int bytes_per_pixel;
 	int bits_per_pixel;
 	enum fb_type type;
 	enum fb_visual visual;
+	enum fb_format format;   /* set at fb_init() */
 	int reserved[4];         /* os specific data */
+	uint64_t backend_state[24]; /* backend specific (linux: fb_var_screeninfo cached for pan_display) */
 };
 
 /* os dependent typedef/include */
@@ -72,13 +104,205 @@ struct fb_info_t {
 	#include "openbsd.h"
 #endif
 
+/* framebuffer backend: selected at fb_init() */
+struct fb_backend_t {
+	const char *name;
+	int (*open)(const char *path);
+	bool (*set_fbinfo)(int fd, struct fb_info_t *info);
+	int (*put_cmap)(int fd, cmap_t *cmap);
+	int (*put_cmap_range)(int fd, cmap_t *cmap, int start, int len);
+	int (*get_cmap)(int fd, cmap_t *cmap);
+	bool (*set_height_virtual)(int fd, struct fb_info_t *info, int height_virtual);
+	bool (*pan_display)(int fd, struct fb_info_t *info, int yoffset);
+	bool (*wait_vsync)(int fd);
+};
+
+/* dirty tiles of shadow buffer (see shadow.h) */
+struct fb_damage_t {
+	int cols, rows;                /* number of tiles */
+	bool *tiles;                   /* dirty flag of each tile */
+	int count;                     /* number of dirty tiles */
+};
+
+/* frame diff of shadow buffer (see shadow.h) */
+struct fb_diff_t {
+	uint8_t *prev;                 /* previous flushed frame (NULL: disabled) */
+	unsigned long compared;        /* byte compared by fb_flush() */
+	unsigned long written;         /* byte written to framebuffer */
+};
+
+/* page flipping state (see flip.h) */
+struct fb_flip_t {
+	int pages;                     /* 1: page flipping disabled */
+	int front;                     /* page displayed now */
+	int height_virtual;            /* original virtual resolution (restored at fb_die) */
+};
+
+/* hardware scrolling state (see scroll.h) */
+struct fb_scroll_t {
+	bool enabled;                  /* false: scroll by memmove */
+	int offset;                    /* yoffset of visible window (fb->buf) */
+	int height_virtual;            /* original virtual resolution (restored at fb_die) */
+};
+
+/* presentation statistics (see present.h): time in nsec */
+struct fb_present_t {
+	bool vsync_unsupported;
+	unsigned long frames;          /* presented frames */
+	unsigned long vblanks;         /* waited vblanks */
+	unsigned long missed;          /* vblanks passed without presentation */
+	int64_t interval;              /* refresh period (shortest vblank interval) */
+	int64_t last_vblank;
+	int64_t latency_last, latency_max, latency_total; /* frame ready -> vblank */
+};
+
+/* ordered dithering (see dither.h) */
+struct fb_dither_t {
+	bool enabled;
+	uint32_t threshold[8][8];      /* added to color: (red << 16) | (green << 8) | blue */
+};
+
+/* palette animation: dirty entries of cmap (see palette.h) */
+struct fb_palette_t {
+	int colors;                    /* entries of cmap (0: truecolor, no cmap) */
+	uint8_t *dirty;                /* per entry (NULL: not allocated yet) */
+	int first, last;               /* dirty entries are in [first, last) */
+	unsigned long uploads, entries; /* put_cmap_range calls, uploaded entries */
+};
+
+/* instrumentation (see stats.h): since fb_open() or fb_stats_reset(), time in nsec */
+enum fb_stats_ioctl {
+	STATS_IOCTL_FBINFO = 0,        /* set_fbinfo */
+	STATS_IOCTL_PUT_CMAP,          /* put_cmap, put_cmap_range */
+	STATS_IOCTL_GET_CMAP,
+	STATS_IOCTL_HEIGHT_VIRTUAL,    /* set_height_virtual */
+	STATS_IOCTL_PAN,               /* pan_display */
+	STATS_IOCTL_VSYNC,             /* wait_vsync */
+	STATS_IOCTL_NUM,
+};
+
+enum fb_stats_phase {
+	STATS_PHASE_OPEN = 0,
+	STATS_PHASE_FBINFO,
+	STATS_PHASE_MMAP,
+	STATS_PHASE_PREFAULT,          /* YAFB_PREFAULT=0: not prefaulted */
+	STATS_PHASE_CMAP,
+	STATS_PHASE_SHADOW,            /* fb_shadow_init(): allocation and copy of framebuffer */
+	STATS_PHASE_DIFF,              /* fb_diff_init(): same as above for previous frame */
+	STATS_PHASE_NUM,
+};
+
+enum fb_stats_misc {
+	STATS_HIST_BUCKETS = 20,       /* bucket i: [2^i, 2^(i + 1)) usec (bucket 0: < 2 usec, last: longer) */
+};
+
+struct fb_stats_t {
+	uint64_t vram_bytes;           /* written to framebuffer memory (drawing, flush, scroll) */
+	uint64_t pixels_converted;     /* 24bit color -> pixel (blit from other format, blend) */
+	uint64_t flushes;              /* fb_flush() with dirty tiles */
+	uint64_t ioctls[STATS_IOCTL_NUM]; /* backend calls by type */
+	unsigned long flush_hist[STATS_HIST_BUCKETS];   /* duration of fb_flush() */
+	unsigned long present_hist[STATS_HIST_BUCKETS]; /* fb_present(): call -> frame shown */
+	int64_t init_phase[STATS_PHASE_NUM];            /* fb_open() and buffer initialization */
+};
+
+/* raw video playback (see video.h) */
+enum fb_video_type {
+	VIDEO_FARBFELD = 0,            /* stream of farbfeld images (16bit RGBA) */
+	VIDEO_PPM,                     /* stream of ppm (P6) images */
+	VIDEO_RAW,                     /* headerless frames of given size and format */
+};
+
+struct fb_video_stats_t {
+	unsigned long shown;           /* frames written and presented */
+	unsigned long dropped;         /* frames skipped because they were late more than one interval */
+	unsigned long starved;         /* writer waited for reader (input or decode is slower than output) */
+};
+
+/* screenshot (see capture.h) */
+enum fb_capture_type {
+	CAPTURE_FARBFELD = 0,          /* farbfeld image (16bit RGBA, opaque) */
+	CAPTURE_PPM,                   /* ppm (P6) image */
+	CAPTURE_RAW,                   /* headerless XRGB8888 (32bit colors in host byte order) */
+};
+
+/* glyph rendered in native pixel format (see glyph.h) */
+struct glyph_entry_t {
+	uint32_t code, fg, bg;         /* key */
+	int width, height;
+	uint32_t hash;
+	size_t size;                   /* byte of this entry (including pixels) */
+	struct glyph_entry_t *hash_next;
+	struct glyph_entry_t *lru_prev, *lru_next;
+	uint8_t pixels[];              /* width * height * bytes_per_pixel */
+};
+
+struct glyph_cache_t {
+	struct glyph_entry_t **table;  /* hash table (chained) */
+	size_t table_size;             /* power of 2 */
+	struct glyph_entry_t *lru_head, *lru_tail; /* most/least recently used */
+	size_t used, budget;           /* byte */
+	unsigned long hits, misses;
+};
+
 struct framebuffer_t {
 	int fd;                        /* file descriptor of framebuffer */
 	uint8_t *fp;                   /* pointer of framebuffer */
+	uint8_t *buf;                  /* drawing target: fp or shadow */
+	uint8_t *shadow;               /* shadow buffer (NULL: disabled) */
+	struct fb_damage_t damage;
+	struct fb_diff_t diff;
+	struct fb_flip_t flip;
+	struct fb_scroll_t scroll;
+	struct fb_present_t present;
+	struct fb_dither_t dither;
+	struct fb_palette_t palette;
+	struct fb_stats_t stats;
+	struct glyph_cache_t *glyph_cache; /* NULL: disabled */
+	struct thread_pool_t *pool;    /* NULL: single thread */
 	struct fb_info_t info;
 	cmap_t *cmap, *cmap_orig;
+	const struct fb_backend_t *backend;
 };
 
+/* native backend: os specific ioctl (defined in {linux,freebsd,netbsd,openbsd}.h) */
+int native_open(const char *path)
+{
+	return eopen(path, O_RDWR);
+}
+
+const struct fb_backend_t fb_backend_native = {
+	.name       = "native",
+	.open       = native_open,
+	.set_fbinfo = set_fbinfo,
+	.put_cmap   = put_cmap,
+	.put_cmap_range = put_cmap_range,
+	.get_cmap   = get_cmap,
+	.set_height_virtual = set_height_virtual,
+	.pan_display        = pan_display,
+	.wait_vsync         = wait_vsync,
+};
+
+#include "cpu.h"
+#include "pixel.h"
+#include "pool.h"
+#include "stream.h"
+#include "stats.h"
+#include "mapping.h"
+#include "shadow.h"
+#include "flip.h"
+#include "palette.h"
+#include "present.h"
+#include "dither.h"
+#include "fill.h"
+#include "blit.h"
+#include "blend.h"
+#include "glyph.h"
+#include "scroll.h"
+#include "video.h"
+#include "capture.h"
+#include "virtual.h"
+
 /* common framebuffer functions */
 void cmap_die(cmap_t *cmap)
 {
@@ -111,10 +335,11 @@ cmap_t *cmap_create(int colors)
 	return cmap;
 }
 
-bool cmap_update(int fd, cmap_t *cmap)
+bool cmap_update(struct framebuffer_t *fb, cmap_t *cmap)
 {
 	if (cmap) {
-		if (put_cmap(fd, cmap)) {
+		stats_ioctl(fb, STATS_IOCTL_PUT_CMAP);
+		if (fb->backend->put_cmap(fb->fd, cmap)) {
 			logging(ERROR, "put_cmap failed\n");
 			return false;
 		}
@@ -122,17 +347,19 @@ bool cmap_update(int fd, cmap_t *cmap)
 	return true;
 }
 
-bool cmap_save(int fd, cmap_t *cmap)
+bool cmap_save(struct framebuffer_t *fb, cmap_t *cmap)
 {
-	if (get_cmap(fd, cmap)) {
+	stats_ioctl(fb, STATS_IOCTL_GET_CMAP);
+	if (fb->backend->get_cmap(fb->fd, cmap)) {
 		logging(WARN, "get_cmap failed\n");
 		return false;
 	}
 	return true;
 }
 
-bool cmap_init(int fd, struct fb_info_t *info, cmap_t *cmap, int colors, int length)
+bool cmap_init(struct framebuffer_t *fb, cmap_t *cmap, int colors, int length)
 {
+	struct fb_info_t *info = &fb->info;
 	uint16_t r, g, b, r_index, g_index, b_index;
 
 	for (int i = 0; i < colors; i++) {
@@ -164,30 +391,12 @@ bool cmap_init(int fd, struct fb_info_t *info, cmap_t *cmap, int colors, int len
 		}
 	}
 
-	if (!cmap_update(fd, cmap))
+	if (!cmap_update(fb, cmap))
 		return false;
 
 	return true;
 }
 
-static inline uint32_t color2pixel(struct fb_info_t *info, uint32_t color)
-{
-	uint32_t r, g, b;
-
-	r = bit_mask[BITS_PER_RGB] & (color >> (BITS_PER_RGB * 2));
-	g = bit_mask[BITS_PER_RGB] & (color >>  BITS_PER_RGB);
-	b = bit_mask[BITS_PER_RGB] & (color >>  0);
-
-	r = r >> (BITS_PER_RGB - info->red.length);
-	g = g >> (BITS_PER_RGB - info->green.length);
-	b = b >> (BITS_PER_RGB - info->blue.length);
-
-	return (r << info->red.offset)
-			+ (g << info->green.offset)
-			+ (b << info->blue.offset);
-}
-
-
 bool init_truecolor(struct fb_info_t *info, cmap_t **cmap, cmap_t **cmap_orig)
 {
 	switch(info->bits_per_pixel) {
@@ -206,8 +415,9 @@ bool init_truecolor(struct fb_info_t *info, cmap_t **cmap, cmap_t **cmap_orig)
 	return true;
 }
 
-bool init_indexcolor(int fd, struct fb_info_t *info, cmap_t **cmap, cmap_t **cmap_orig)
+bool init_indexcolor(struct framebuffer_t *fb, cmap_t **cmap, cmap_t **cmap_orig)
 {
+	struct fb_info_t *info = &fb->info;
 	int colors, max_length;
 
 	if (info->visual == YAFT_FB_VISUAL_DIRECTCOLOR) {
@@ -259,14 +469,15 @@ bool init_indexcolor(int fd, struct fb_info_t *info, cmap_t **cmap, cmap_t **cma
 	if (!(*cmap) || !(*cmap_orig))
 		goto cmap_init_err;
 
-	if (!cmap_save(fd, *cmap_orig)) {
+	if (!cmap_save(fb, *cmap_orig)) {
 		logging(WARN, "couldn't save original cmap\n");
 		cmap_die(*cmap_orig);
 		*cmap_orig = NULL;
 	}
 
-	if (!cmap_init(fd, info, *cmap, colors, max_length))
+	if (!cmap_init(fb, *cmap, colors, max_length))
 		goto cmap_init_err;
+	fb->palette.colors = colors;
 
 	return true;
 
@@ -276,6 +487,16 @@ cmap_init_err:
 	return false;
 }
 
+const char *format_str[] = {
+	[YAFT_FB_FORMAT_GENERIC]  = "YAFT_FB_FORMAT_GENERIC",
+	[YAFT_FB_FORMAT_XRGB8888] = "YAFT_FB_FORMAT_XRGB8888",
+	[YAFT_FB_FORMAT_XBGR8888] = "YAFT_FB_FORMAT_XBGR8888",
+	[YAFT_FB_FORMAT_RGB888]   = "YAFT_FB_FORMAT_RGB888",
+	[YAFT_FB_FORMAT_RGB565]   = "YAFT_FB_FORMAT_RGB565",
+	[YAFT_FB_FORMAT_RGB555]   = "YAFT_FB_FORMAT_RGB555",
+	[YAFT_FB_FORMAT_RGB332]   = "YAFT_FB_FORMAT_RGB332",
+};
+
 void fb_print_info(struct fb_info_t *info)
 {
 	const char *type_str[] = {
@@ -295,37 +516,89 @@ void fb_print_info(struct fb_info_t *info)
 	logging(DEBUG, "\tred(off:%d len:%d) green(off:%d len:%d) blue(off:%d len:%d)\n",
 		info->red.offset, info->red.length, info->green.offset, info->green.length, info->blue.offset, info->blue.length);
 	logging(DEBUG, "\tresolution %dx%d\n", info->width, info->height);
-	logging(DEBUG, "\tscreen size:%ld line length:%d\n", info->screen_size, info->line_length);
+	logging(DEBUG, "\tscreen size:%ld virtual size:%ld memory size:%ld line length:%d\n",
+		info->screen_size, info->virtual_size, info->memory_size, info->line_length);
+	logging(DEBUG, "\tvirtual height:%d ypanstep:%d\n", info->height_virtual, info->ypanstep);
 	logging(DEBUG, "\tbits_per_pixel:%d bytes_per_pixel:%d\n", info->bits_per_pixel, info->bytes_per_pixel);
 	logging(DEBUG, "\ttype:%s\n", type_str[info->type]);
 	logging(DEBUG, "\tvisual:%s\n", visual_str[info->visual]);
 }
 
-bool fb_init(struct framebuffer_t *fb)
+/* select SIMD kernels for running cpu */
+void cpu_dispatch(void)
 {
-	extern const char *fb_path; /* defined in {linux,freebsd,netbsd,openbsd}.h */
-	const char *path;
-	char *env;
+	enum cpu_level level = cpu_init();
 
-	/* open framebuffer device: check FRAMEBUFFER env at first */
-	path = ((env = getenv("FRAMEBUFFER")) == NULL) ? fb_path: env;
-	if ((fb->fd = eopen(path, O_RDWR)) < 0)
+	pixel_dispatch(level);
+	blend_dispatch(level);
+	diff_dispatch(level);
+	stream_dispatch(level);
+	capture_dispatch(level);
+}
+
+/* process-wide setup (log level, SIMD kernels): done once, even if framebuffers are opened by several threads */
+pthread_once_t fb_once = PTHREAD_ONCE_INIT;
+
+void fb_once_init(void)
+{
+	log_init();
+	cpu_dispatch();
+}
+
+bool fb_open(struct framebuffer_t *fb, const struct fb_backend_t *backend, const char *path)
+{
+	int64_t start;
+
+	fb->backend = backend;
+	fb->shadow  = NULL;
+	fb->diff.prev = NULL;
+	fb->glyph_cache = NULL;
+	fb->pool = NULL;
+	fb->flip.pages = 1;
+	fb->flip.front = 0;
+	fb->scroll.enabled = false;
+	memset(&fb->present, 0, sizeof(struct fb_present_t));
+	fb->dither.enabled = false;
+	memset(&fb->palette, 0, sizeof(struct fb_palette_t));
+	memset(&fb->stats, 0, sizeof(struct fb_stats_t));
+	pthread_once(&fb_once, fb_once_init);
+
+	/* open framebuffer device */
+	start = stats_clock();
+	if ((fb->fd = backend->open(path)) < 0)
 		return false;
+	start = stats_phase(fb, STATS_PHASE_OPEN, start);
 
-	/* os dependent initialize */
-	if (!set_fbinfo(fb->fd, &fb->info))
+	/* backend dependent initialize */
+	stats_ioctl(fb, STATS_IOCTL_FBINFO);
+	if (!backend->set_fbinfo(fb->fd, &fb->info))
 		goto set_fbinfo_failed;
+	info_set_size(&fb->info);
+	start = stats_phase(fb, STATS_PHASE_FBINFO, start);
 
-	if (VERBOSE)
-		fb_print_info(&fb->info);
+	logging(DEBUG, "backend:%s path:%s\n", backend->name, path);
+	fb_print_info(&fb->info);
 
-	/* allocate memory */
+	if (fb->info.memory_size < fb->info.screen_size) {
+		logging(ERROR, "framebuffer memory (%ld) is smaller than visible area (%ld)\n",
+			fb->info.memory_size, fb->info.screen_size);
+		goto set_fbinfo_failed;
+	}
+
+	/* map only visible area: virtual screen is mapped when page flipping/scrolling needs it */
 	fb->fp   = (uint8_t *) emmap(0, fb->info.screen_size,
 				PROT_WRITE | PROT_READ, MAP_SHARED, fb->fd, 0);
 
 	/* error check */
 	if (fb->fp == MAP_FAILED)
 		goto allocate_failed;
+	fb->buf = fb->fp;
+	fb->info.mapped_size = fb->info.screen_size;
+	start = stats_phase(fb, STATS_PHASE_MMAP, start);
+
+	if (prefault_enabled())
+		prefault(fb->fp, fb->info.screen_size);
+	start = stats_phase(fb, STATS_PHASE_PREFAULT, start);
 
 	if (fb->info.type != YAFT_FB_TYPE_PACKED_PIXELS) {
 		/* TODO: support planes type */
@@ -338,32 +611,86 @@ bool fb_init(struct framebuffer_t *fb)
 			goto fb_init_failed;
 	} else if (fb->info.visual == YAFT_FB_VISUAL_DIRECTCOLOR
 		|| fb->info.visual == YAFT_FB_VISUAL_PSEUDOCOLOR) {
-		if (!init_indexcolor(fb->fd, &fb->info, &fb->cmap, &fb->cmap_orig))
+		if (!init_indexcolor(fb, &fb->cmap, &fb->cmap_orig))
 			goto fb_init_failed;
 	} else {
 		/* TODO: support mono visual */
 		logging(ERROR, "unsupport framebuffer visual\n");
 		goto fb_init_failed;
 	}
+	stats_phase(fb, STATS_PHASE_CMAP, start);
+
+	if (STATS)
+		logging(DEBUG, "init phase (usec): open:%ld fbinfo:%ld mmap:%ld prefault:%ld cmap:%ld\n",
+			(long) (fb->stats.init_phase[STATS_PHASE_OPEN] / 1000),
+			(long) (fb->stats.init_phase[STATS_PHASE_FBINFO] / 1000),
+			(long) (fb->stats.init_phase[STATS_PHASE_MMAP] / 1000),
+			(long) (fb->stats.init_phase[STATS_PHASE_PREFAULT] / 1000),
+			(long) (fb->stats.init_phase[STATS_PHASE_CMAP] / 1000));
+
+	/* select specialized pixel packer */
+	fb->info.format = get_format(&fb->info);
+	logging(DEBUG, "format:%s\n", format_str[fb->info.format]);
 
 	return true;
 
 fb_init_failed:
 allocate_failed:
 	if (fb->fp != MAP_FAILED)
-		emunmap(fb->fp, fb->info.screen_size);
+		emunmap(fb->fp, fb->info.mapped_size);
 set_fbinfo_failed:
 	eclose(fb->fd);
 	return false;
 }
 
+bool fb_init_virtual(struct framebuffer_t *fb, const struct fb_info_t *mode)
+{
+	/* virtual backend reads requested mode from fb->info in set_fbinfo() */
+	memset(&fb->info, 0, sizeof(struct fb_info_t));
+	if (mode)
+		fb->info = *mode;
+	else
+		virtual_default_mode(&fb->info);
+
+	return fb_open(fb, &fb_backend_virtual, "virtual");
+}
+
+/* native backend on given device path (e.g. "/dev/fb1"): FRAMEBUFFER and YAFB_BACKEND env are not used
+	each framebuffer_t owns its device state, so several devices can be driven from separate threads */
+bool fb_init_device(struct framebuffer_t *fb, const char *path)
+{
+	return fb_open(fb, &fb_backend_native, path);
+}
+
+bool fb_init(struct framebuffer_t *fb)
+{
+	extern const char *fb_path; /* defined in {linux,freebsd,netbsd,openbsd}.h */
+	const char *path;
+	char *env;
+
+	/* select backend: check YAFB_BACKEND env at first */
+	if ((env = getenv("YAFB_BACKEND")) != NULL && strcmp(env, "virtual") == 0)
+		return fb_init_virtual(fb, NULL);
+
+	/* open framebuffer device: check FRAMEBUFFER env at first */
+	path = ((env = getenv("FRAMEBUFFER")) == NULL) ? fb_path: env;
+	return fb_init_device(fb, path);
+}
+
 void fb_die(struct framebuffer_t *fb)
 {
+	fb_pool_die(fb);
+	fb_glyph_cache_die(fb);
+	fb_scroll_die(fb);
+	fb_flip_die(fb);
+	fb_shadow_die(fb);
+	fb_palette_die(fb);
 	cmap_die(fb->cmap);
 	if (fb->cmap_orig) {
-		put_cmap(fb->fd, fb->cmap_orig);
+		stats_ioctl(fb, STATS_IOCTL_PUT_CMAP);
+		fb->backend->put_cmap(fb->fd, fb->cmap_orig);
 		cmap_die(fb->cmap_orig);
 	}
-	emunmap(fb->fp, fb->info.screen_size);
+	emunmap(fb->fp, fb->info.mapped_size);
 	eclose(fb->fd);
 }
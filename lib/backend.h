@@ -0,0 +1,21 @@
+/* See LICENSE for licence details. */
+/* framebuffer backend: selected at fb_init() */
+struct fb_backend_t {
+	const char *name;
+	int (*open)(const char *path);
+	bool (*set_fbinfo)(int fd, struct fb_info_t *info);
+	int (*put_cmap)(int fd, cmap_t *cmap);
+	int (*put_cmap_range)(int fd, cmap_t *cmap, int start, int len);
+	int (*get_cmap)(int fd, cmap_t *cmap);
+	bool (*set_height_virtual)(int fd, struct fb_info_t *info, int height_virtual);
+	bool (*pan_display)(int fd, struct fb_info_t *info, int yoffset);
+	bool (*wait_vsync)(int fd);
+};
+
+/* defined in yafblib.c and virtual.c */
+extern const struct fb_backend_t fb_backend_native, fb_backend_virtual;
+void virtual_default_mode(struct fb_info_t *mode);
+
+/* defined in flip.c: map [0, size) of framebuffer memory, resize virtual screen */
+bool flip_remap(struct framebuffer_t *fb, long size);
+bool flip_set_height_virtual(struct framebuffer_t *fb, int height_virtual);
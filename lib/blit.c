@@ -0,0 +1,146 @@
+/* See LICENSE for licence details. */
+/* blit: copy rectangle of caller's buffer (any known format/stride) to screen
+	same format: row memcpy, otherwise src -> 24bit color -> pixel by chunk in each row */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "util.h"
+#include "yafblib.h"
+#include "dither.h"
+#include "stream.h"
+#include "stats.h"
+
+enum blit_misc {
+	BLIT_CHUNK = 256, /* pixels converted at once (color buffer on stack): multiple of DITHER_SIZE */
+};
+
+/* rows of 32bpp formats must be 4 bytes aligned, threshold: dither row of dst (see dither.c) or NULL */
+static void blit_span(struct fb_info_t *info, uint8_t *dst, const uint8_t *src, enum fb_format src_format, int n,
+	const uint32_t *threshold)
+{
+	uint32_t colors[BLIT_CHUNK];
+	int src_bpp = format_bytes_per_pixel(src_format), len;
+
+	if (src_format == info->format) {
+		memcpy(dst, src, (size_t) n * info->bytes_per_pixel);
+		return;
+	}
+
+	if (src_format == YAFT_FB_FORMAT_XRGB8888) {
+		color2pixel_dither_n(info, dst, (const uint32_t *) src, n, threshold);
+		return;
+	}
+
+	for (int i = 0; i < n; i += len) {
+		len = (n - i > BLIT_CHUNK) ? BLIT_CHUNK: n - i;
+		pixel2color_n(src_format, colors, src + i * src_bpp, len);
+		color2pixel_dither_n(info, dst + i * info->bytes_per_pixel, colors, len, threshold);
+	}
+}
+
+void blit_row(struct fb_info_t *info, uint8_t *dst, const uint8_t *src, enum fb_format src_format, int n)
+{
+	blit_span(info, dst, src, src_format, n, NULL);
+}
+
+/* framebuffer memory: convert into chunk on stack, then streaming copy */
+static void blit_row_stream(struct fb_info_t *info, uint8_t *dst, const uint8_t *src, enum fb_format src_format, int n,
+	const uint32_t *threshold)
+{
+	uint32_t pixels[BLIT_CHUNK];
+	int src_bpp = format_bytes_per_pixel(src_format), len;
+
+	if (src_format == info->format) {
+		stream_copy(dst, src, (size_t) n * info->bytes_per_pixel);
+		return;
+	}
+
+	for (int i = 0; i < n; i += len) {
+		len = (n - i > BLIT_CHUNK) ? BLIT_CHUNK: n - i;
+		blit_span(info, (uint8_t *) pixels, src + i * src_bpp, src_format, len, threshold);
+		stream_copy(dst + i * info->bytes_per_pixel, (const uint8_t *) pixels, (size_t) len * info->bytes_per_pixel);
+	}
+}
+
+/* copy width x height pixels from src (stride: bytes per line) to (x, y) of screen (clipped) */
+struct blit_job_t {
+	struct fb_info_t *info;
+	uint8_t *dst;
+	const uint8_t *src;
+	int src_stride;
+	enum fb_format src_format;
+	int width;
+	bool stream;                   /* dst is framebuffer memory */
+	const struct fb_dither_t *dither;
+	int x, y;                      /* position of dst on screen (phase of dither) */
+};
+
+static void blit_band(void *arg, int y, int height)
+{
+	struct blit_job_t *job = (struct blit_job_t *) arg;
+	uint8_t *dst = job->dst + (long) y * job->info->line_length;
+	const uint8_t *src = job->src + (long) y * job->src_stride;
+	uint32_t row[DITHER_SIZE];
+	const uint32_t *threshold;
+
+	for (int h = 0; h < height; h++) {
+		threshold = dither_row(job->dither, row, job->x, job->y + y + h);
+		if (job->stream)
+			blit_row_stream(job->info, dst, src, job->src_format, job->width, threshold);
+		else
+			blit_span(job->info, dst, src, job->src_format, job->width, threshold);
+		dst += job->info->line_length;
+		src += job->src_stride;
+	}
+}
+
+void fb_blit(struct framebuffer_t *fb, int x, int y, const uint8_t *src, int src_stride,
+	enum fb_format src_format, int width, int height)
+{
+	struct fb_info_t *info = &fb->info;
+	int src_bpp = format_bytes_per_pixel(src_format);
+	struct blit_job_t job;
+
+	if (src_bpp == 0) {
+		logging(ERROR, "blit: unknown source format\n");
+		return;
+	}
+
+	/* clipping */
+	if (x < 0) {
+		src   -= x * src_bpp;
+		width += x;
+		x = 0;
+	}
+	if (y < 0) {
+		src    -= (long) y * src_stride;
+		height += y;
+		y = 0;
+	}
+	if (width > info->width - x)
+		width = info->width - x;
+	if (height > info->height - y)
+		height = info->height - y;
+	if (width <= 0 || height <= 0)
+		return;
+
+	job.info       = info;
+	job.dst        = fb->buf + y * info->line_length + x * info->bytes_per_pixel;
+	job.src        = src;
+	job.src_stride = src_stride;
+	job.src_format = src_format;
+	job.width      = width;
+	job.stream     = buf_is_device(fb);
+	job.dither     = &fb->dither;
+	job.x          = x;
+	job.y          = y;
+	fb_damage(fb, x, y, width, height);
+	stats_vram(fb, (long) width * height * info->bytes_per_pixel);
+	if (src_format != info->format)
+		stats_add(&fb->stats.pixels_converted, (long) width * height);
+
+	fb_pool_run(fb, blit_band, &job, height, (long) width * height * info->bytes_per_pixel);
+}
@@ -0,0 +1,255 @@
+/* See LICENSE for licence details. */
+/* screenshot: visible screen is read in chunks of lines (from framebuffer memory by streaming loads into
+	cached buffer, or from shadow buffer directly), converted to 24bit colors by pixel2color_n() (8bpp pseudocolor:
+	current cmap) and written as farbfeld/ppm/raw chunk by chunk: no copy of whole screen, no per pixel access */
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "util.h"
+#include "yafblib.h"
+
+#if defined(__linux__)
+	#include "linux.h"
+#elif defined(__FreeBSD__)
+	#include "freebsd.h"
+#elif defined(__NetBSD__)
+	#include "netbsd.h"
+#elif defined(__OpenBSD__)
+	#include "openbsd.h"
+#endif
+
+#include "cpu.h"
+#include "stream.h"
+
+enum capture_misc {
+	CAPTURE_CHUNK       = 64 * 1024, /* byte: native pixels read at once (at least one line) */
+	CAPTURE_HEADER_SIZE = 32,
+	CAPTURE_PALETTE     = 256,       /* entries: pixel of 8bpp pseudocolor */
+};
+
+/* 24bit colors -> R, G, B bytes (ppm) */
+static void capture_ppm_n_base(uint8_t *dst, const uint32_t *src, int n)
+{
+	for (int i = 0; i < n; i++) {
+		dst[i * 3 + 0] = (src[i] >> 16) & 0xFF;
+		dst[i * 3 + 1] = (src[i] >> 8) & 0xFF;
+		dst[i * 3 + 2] = src[i] & 0xFF;
+	}
+}
+
+/* 24bit colors -> 16bit big endian R, G, B, A (farbfeld): value v is (v << 8) | v, alpha is opaque */
+static void capture_farbfeld_n_base(uint8_t *dst, const uint32_t *src, int n)
+{
+	uint8_t *d;
+
+	for (int i = 0; i < n; i++) {
+		d = dst + i * 8;
+		d[0] = d[1] = (src[i] >> 16) & 0xFF;
+		d[2] = d[3] = (src[i] >> 8) & 0xFF;
+		d[4] = d[5] = src[i] & 0xFF;
+		d[6] = d[7] = 0xFF;
+	}
+}
+
+#if defined(CPU_DISPATCH)
+/* same as color2rgb888_n_ssse3() with red and blue swapped */
+TARGET_SSSE3
+static void capture_ppm_n_ssse3(uint8_t *dst, const uint32_t *src, int n)
+{
+	const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+	int i = 0;
+
+	for (; i + 16 <= n; i += 16) {
+		__m128i p0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (src + i)), pack);
+		__m128i p1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (src + i + 4)), pack);
+		__m128i p2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (src + i + 8)), pack);
+		__m128i p3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (src + i + 12)), pack);
+		uint8_t *d = dst + i * 3;
+
+		_mm_storeu_si128((__m128i *) (d +  0), _mm_or_si128(p0, _mm_slli_si128(p1, 12)));
+		_mm_storeu_si128((__m128i *) (d + 16), _mm_or_si128(_mm_srli_si128(p1, 4), _mm_slli_si128(p2, 8)));
+		_mm_storeu_si128((__m128i *) (d + 32), _mm_or_si128(_mm_srli_si128(p2, 8), _mm_slli_si128(p3, 4)));
+	}
+	capture_ppm_n_base(dst + i * 3, src + i, n - i);
+}
+
+/* 4 colors (16 bytes) -> 2 vectors: each byte of color is duplicated, alpha bytes are set by or */
+TARGET_SSSE3
+static void capture_farbfeld_n_ssse3(uint8_t *dst, const uint32_t *src, int n)
+{
+	const __m128i lo = _mm_setr_epi8(2, 2, 1, 1, 0, 0, -1, -1, 6, 6, 5, 5, 4, 4, -1, -1);
+	const __m128i hi = _mm_setr_epi8(10, 10, 9, 9, 8, 8, -1, -1, 14, 14, 13, 13, 12, 12, -1, -1);
+	const __m128i alpha = _mm_setr_epi8(0, 0, 0, 0, 0, 0, -1, -1, 0, 0, 0, 0, 0, 0, -1, -1);
+	int i = 0;
+
+	for (; i + 4 <= n; i += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (src + i));
+
+		_mm_storeu_si128((__m128i *) (dst + i * 8),      _mm_or_si128(_mm_shuffle_epi8(v, lo), alpha));
+		_mm_storeu_si128((__m128i *) (dst + i * 8 + 16), _mm_or_si128(_mm_shuffle_epi8(v, hi), alpha));
+	}
+	capture_farbfeld_n_base(dst + i * 8, src + i, n - i);
+}
+#endif
+
+static void (*capture_ppm_kernel)(uint8_t *dst, const uint32_t *src, int n)      = capture_ppm_n_base;
+static void (*capture_farbfeld_kernel)(uint8_t *dst, const uint32_t *src, int n) = capture_farbfeld_n_base;
+
+void capture_dispatch(enum cpu_level level)
+{
+	capture_ppm_kernel      = capture_ppm_n_base;
+	capture_farbfeld_kernel = capture_farbfeld_n_base;
+
+#if defined(CPU_DISPATCH)
+	if (level >= CPU_SSSE3) {
+		capture_ppm_kernel      = capture_ppm_n_ssse3;
+		capture_farbfeld_kernel = capture_farbfeld_n_ssse3;
+	}
+#else
+	(void) level;
+#endif
+}
+
+/* first line of visible screen: shadow buffer has latest drawing (may be ahead of screen until fb_flush()) */
+static inline const uint8_t *capture_screen(struct framebuffer_t *fb)
+{
+	if (fb->shadow)
+		return fb->shadow;
+	else if (fb->flip.pages > 1)
+		return fb->fp + (long) fb->flip.front * fb->info.height * fb->info.line_length;
+	else
+		return fb->buf; /* framebuffer, or visible window of hardware scrolling */
+}
+
+/* 24bit colors of pseudocolor palette: entries modified by fb_palette_*() are in cmap */
+static void capture_palette(struct framebuffer_t *fb, uint32_t *palette)
+{
+	cmap_t *cmap = fb->cmap;
+	uint32_t r, g, b;
+
+	for (int i = 0; i < fb->palette.colors && i < CAPTURE_PALETTE; i++) {
+		r = cmap->red[i] >> (CMAP_COLOR_LENGTH - BITS_PER_BYTE);
+		g = cmap->green[i] >> (CMAP_COLOR_LENGTH - BITS_PER_BYTE);
+		b = cmap->blue[i] >> (CMAP_COLOR_LENGTH - BITS_PER_BYTE);
+		palette[i] = (r << 16) | (g << 8) | b;
+	}
+}
+
+/* native pixels -> 24bit colors (palette: NULL if not pseudocolor) */
+static void capture_colors(struct fb_info_t *info, const uint32_t *palette, uint32_t *dst, const uint8_t *src, int n)
+{
+	if (palette) {
+		for (int i = 0; i < n; i++)
+			dst[i] = palette[src[i]];
+	} else if (!pixel2color_n(info->format, dst, src, n)) {
+		pixel2color_generic_n(info, dst, src, n);
+	}
+}
+
+static bool capture_write(FILE *fp, const uint8_t *buf, size_t size)
+{
+	errno = 0;
+
+	if (fwrite(buf, 1, size, fp) != size) {
+		logging(ERROR, "capture: write: %s\n", strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+/* header of image: return size (0: unknown type) */
+static int capture_header(enum fb_capture_type type, uint8_t *header, int width, int height, int *out_bpp)
+{
+	switch (type) {
+	case CAPTURE_FARBFELD:
+		memcpy(header, "farbfeld", 8);
+		for (int i = 0; i < 4; i++) {
+			header[8 + i]  = ((uint32_t) width >> (24 - i * 8)) & 0xFF;
+			header[12 + i] = ((uint32_t) height >> (24 - i * 8)) & 0xFF;
+		}
+		*out_bpp = 8;
+		return 16;
+	case CAPTURE_PPM:
+		*out_bpp = 3;
+		return snprintf((char *) header, CAPTURE_HEADER_SIZE, "P6\n%d %d\n255\n", width, height);
+	case CAPTURE_RAW:
+		*out_bpp = 4;
+		return 0;
+	default:
+		*out_bpp = 0;
+		return 0;
+	}
+}
+
+/* write visible screen to fp (not flushed or closed): return false on write error */
+bool fb_capture(struct framebuffer_t *fb, FILE *fp, enum fb_capture_type type)
+{
+	struct fb_info_t *info = &fb->info;
+	const uint8_t *screen = capture_screen(fb), *src;
+	uint8_t header[CAPTURE_HEADER_SIZE], *buf, *native, *out;
+	uint32_t palette[CAPTURE_PALETTE] = {0}, *colors, *lookup = NULL;
+	size_t row = (size_t) info->width * info->bytes_per_pixel, pixels;
+	int header_size, out_bpp, lines, n;
+	bool device = (screen != fb->shadow), ok = true;
+
+	header_size = capture_header(type, header, info->width, info->height, &out_bpp);
+	if (out_bpp == 0) {
+		logging(ERROR, "capture: unknown type %d\n", type);
+		return false;
+	}
+
+	if ((lines = CAPTURE_CHUNK / row) < 1)
+		lines = 1;
+	else if (lines > info->height)
+		lines = info->height;
+	pixels = (size_t) lines * info->width;
+
+	/* chunk buffer: native pixels (framebuffer memory only), colors, output (raw: colors) */
+	if ((buf = (uint8_t *) ecalloc(pixels, (device ? info->bytes_per_pixel: 0)
+		+ sizeof(uint32_t) + (type == CAPTURE_RAW ? 0: out_bpp))) == NULL)
+		return false;
+	colors = (uint32_t *) buf;
+	native = buf + pixels * sizeof(uint32_t);
+	out    = (type == CAPTURE_RAW) ? buf: native + (device ? pixels * info->bytes_per_pixel: 0);
+
+	if (info->visual == YAFT_FB_VISUAL_PSEUDOCOLOR && fb->cmap) {
+		capture_palette(fb, palette);
+		lookup = palette;
+	}
+
+	if (header_size > 0)
+		ok = capture_write(fp, header, header_size);
+
+	for (int y = 0; ok && y < info->height; y += n) {
+		n = (info->height - y > lines) ? lines: info->height - y;
+
+		/* no padding: lines of chunk are read by one large streaming read */
+		if (device && (size_t) info->line_length == row)
+			stream_read(native, screen + (long) y * info->line_length, row * n);
+
+		for (int i = 0; i < n; i++) {
+			src = screen + (long) (y + i) * info->line_length;
+			if (device) {
+				if ((size_t) info->line_length != row)
+					stream_read(native + i * row, src, row);
+				src = native + i * row;
+			}
+			capture_colors(info, lookup, colors + (size_t) i * info->width, src, info->width);
+		}
+
+		if (type == CAPTURE_PPM)
+			capture_ppm_kernel(out, colors, n * info->width);
+		else if (type == CAPTURE_FARBFELD)
+			capture_farbfeld_kernel(out, colors, n * info->width);
+
+		ok = capture_write(fp, out, (size_t) n * info->width * out_bpp);
+	}
+
+	free(buf);
+	return ok;
+}
@@ -0,0 +1,74 @@
+/* See LICENSE for licence details. */
+/* runtime cpu dispatch: SIMD kernels are compiled for each instruction set (function target attribute)
+	and selected by cpu_dispatch() at first fb_open() by cpuid (__builtin_cpu_supports)
+	base kernels use only compile-time instruction set (SSE2 on x86_64) */
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "util.h"
+#include "cpu.h"
+
+static const char *cpu_level_str[] = {
+	[CPU_BASE]   = "base",
+	[CPU_SSE2]   = "sse2",
+	[CPU_SSSE3]  = "ssse3",
+	[CPU_AVX2]   = "avx2",
+	[CPU_AVX512] = "avx512",
+};
+
+enum cpu_level cpu_level = CPU_BASE;
+
+/* detect instruction set of running cpu: YAFB_CPU env (e.g. "sse2") limits level */
+enum cpu_level cpu_init(void)
+{
+	enum cpu_level max = CPU_AVX512;
+	char *env;
+	int i;
+
+	if ((env = getenv("YAFB_CPU")) != NULL) {
+		for (i = CPU_BASE; i < CPU_LEVEL_NUM; i++) {
+			if (strcmp(env, cpu_level_str[i]) == 0)
+				break;
+		}
+		if (i < CPU_LEVEL_NUM)
+			max = i;
+		else
+			logging(WARN, "unknown YAFB_CPU \"%s\", ignored\n", env);
+	}
+
+	cpu_level = CPU_BASE;
+
+#if defined(CPU_DISPATCH)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2")) {
+		cpu_level = CPU_SSE2;
+		if (__builtin_cpu_supports("ssse3"))
+			cpu_level = CPU_SSSE3;
+		if (cpu_level == CPU_SSSE3 && __builtin_cpu_supports("avx2"))
+			cpu_level = CPU_AVX2;
+		if (cpu_level == CPU_AVX2 && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+			cpu_level = CPU_AVX512;
+	}
+#endif
+
+	if (cpu_level > max)
+		cpu_level = max;
+
+	logging(DEBUG, "cpu: %s\n", cpu_level_str[cpu_level]);
+	return cpu_level;
+}
+
+/* select SIMD kernels for running cpu */
+void cpu_dispatch(void)
+{
+	enum cpu_level level = cpu_init();
+
+	pixel_dispatch(level);
+	blend_dispatch(level);
+	diff_dispatch(level);
+	stream_dispatch(level);
+	capture_dispatch(level);
+}
@@ -0,0 +1,31 @@
+/* See LICENSE for licence details. */
+/* runtime cpu dispatch (cpu.c): SIMD kernels are compiled for each instruction set
+	(function target attribute) and selected by cpu_dispatch() at fb_open() */
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+	#include <immintrin.h>
+	#define CPU_DISPATCH
+	#define TARGET_SSSE3  __attribute__((target("ssse3")))
+	#define TARGET_AVX2   __attribute__((target("avx2")))
+	#define TARGET_AVX512 __attribute__((target("avx2,avx512f,avx512bw")))
+#endif
+
+enum cpu_level {
+	CPU_BASE = 0,
+	CPU_SSE2,
+	CPU_SSSE3,
+	CPU_AVX2,
+	CPU_AVX512, /* AVX-512F and AVX-512BW */
+	CPU_LEVEL_NUM,
+};
+
+extern enum cpu_level cpu_level;
+
+enum cpu_level cpu_init(void);
+void cpu_dispatch(void);
+
+/* kernel selection of each module */
+void pixel_dispatch(enum cpu_level level);
+void blend_dispatch(enum cpu_level level);
+void diff_dispatch(enum cpu_level level);
+void stream_dispatch(enum cpu_level level);
+void capture_dispatch(enum cpu_level level);
@@ -0,0 +1,63 @@
+/* See LICENSE for licence details. */
+/* ordered dithering (8x8 Bayer matrix) for RGB332/RGB565/RGB555 framebuffer
+	threshold of each component is precomputed for its bit length, and added to scaled color
+	before truncation by span conversion kernels (see dither_add() in pixel.c)
+	blit and blend are dithered, solid fill and glyph are not */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "util.h"
+#include "yafblib.h"
+#include "dither.h"
+
+static const uint8_t bayer_matrix[DITHER_SIZE][DITHER_SIZE] = {
+	{ 0, 32,  8, 40,  2, 34, 10, 42},
+	{48, 16, 56, 24, 50, 18, 58, 26},
+	{12, 44,  4, 36, 14, 46,  6, 38},
+	{60, 28, 52, 20, 62, 30, 54, 22},
+	{ 3, 35, 11, 43,  1, 33,  9, 41},
+	{51, 19, 59, 27, 49, 17, 57, 25},
+	{15, 47,  7, 39, 13, 45,  5, 37},
+	{63, 31, 55, 23, 61, 29, 53, 21},
+};
+
+/* bayer value (0-63) -> [0, 2^(8 - length)): step of truncated bits */
+static inline uint32_t dither_threshold(int value, int length)
+{
+	return (length >= 8) ? 0: value >> (length - 2);
+}
+
+void fb_dither_die(struct framebuffer_t *fb)
+{
+	fb->dither.enabled = false;
+}
+
+/* return false if pixel format has no dither kernel (only RGB332/RGB565/RGB555 have) */
+bool fb_dither_init(struct framebuffer_t *fb)
+{
+	struct fb_info_t *info = &fb->info;
+	uint32_t value;
+
+	if (info->format != YAFT_FB_FORMAT_RGB332 && info->format != YAFT_FB_FORMAT_RGB565
+		&& info->format != YAFT_FB_FORMAT_RGB555) {
+		logging(ERROR, "dither: %d bpp format not supported\n", info->bits_per_pixel);
+		return false;
+	}
+
+	for (int y = 0; y < DITHER_SIZE; y++) {
+		for (int x = 0; x < DITHER_SIZE; x++) {
+			value = bayer_matrix[y][x];
+			fb->dither.threshold[y][x] = (dither_threshold(value, info->red.length) << 16)
+				| (dither_threshold(value, info->green.length) << 8)
+				| dither_threshold(value, info->blue.length);
+		}
+	}
+	fb->dither.enabled = true;
+
+	logging(DEBUG, "dither: enabled (red:%d green:%d blue:%d bits)\n",
+		info->red.length, info->green.length, info->blue.length);
+	return true;
+}
@@ -0,0 +1,17 @@
+/* See LICENSE for licence details. */
+/* ordered dithering (dither.c): threshold rows for span conversion kernels */
+enum dither_misc {
+	DITHER_SIZE = 8, /* must be same as size of fb_dither_t.threshold */
+};
+
+/* threshold of DITHER_SIZE pixels from (x, y): row[i] is for pixel (x + i, y)
+	return NULL if dithering is disabled */
+static inline const uint32_t *dither_row(const struct fb_dither_t *dither, uint32_t *row, int x, int y)
+{
+	if (!dither->enabled)
+		return NULL;
+
+	for (int i = 0; i < DITHER_SIZE; i++)
+		row[i] = dither->threshold[y % DITHER_SIZE][(x + i) % DITHER_SIZE];
+	return row;
+}
@@ -0,0 +1,217 @@
+/* See LICENSE for licence details. */
+/* solid fill: row kernels specialized for each bytes_per_pixel
+	prologue aligns dst to 16 bytes, then fills by aligned wide stores
+	(non-temporal stores when filling framebuffer memory, see stream.c) */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+	#include <emmintrin.h>
+#endif
+
+#include "util.h"
+#include "yafblib.h"
+#include "stream.h"
+#include "stats.h"
+
+enum fill_misc {
+	FILL_ALIGN = 16,
+};
+
+#if defined(__SSE2__)
+static inline void fill_store(uint8_t *dst, __m128i v, bool stream)
+{
+	if (stream)
+		_mm_stream_si128((__m128i *) dst, v);
+	else
+		_mm_store_si128((__m128i *) dst, v);
+}
+#endif
+
+static void fill_row8(uint8_t *dst, uint32_t pixel, int n, bool stream)
+{
+	int i = 0;
+
+#if defined(__SSE2__)
+	/* memset is faster for cached memory (shadow buffer) */
+	if (stream) {
+		__m128i v = _mm_set1_epi8(pixel);
+
+		for (; i < n && ((uintptr_t) (dst + i) & (FILL_ALIGN - 1)); i++)
+			dst[i] = pixel;
+		for (; i + 16 <= n; i += 16)
+			fill_store(dst + i, v, stream);
+		_mm_sfence();
+	}
+#else
+	(void) stream;
+#endif
+	memset(dst + i, pixel, n - i);
+}
+
+static void fill_row16(uint8_t *dst, uint32_t pixel, int n, bool stream)
+{
+	int i = 0;
+
+#if defined(__SSE2__)
+	if (((uintptr_t) dst & 1) == 0) {
+		__m128i v = _mm_set1_epi16(pixel);
+
+		for (; i < n && ((uintptr_t) (dst + i * 2) & (FILL_ALIGN - 1)); i++)
+			store_pixel(dst + i * 2, pixel, 2);
+		for (; i + 8 <= n; i += 8)
+			fill_store(dst + i * 2, v, stream);
+		if (stream)
+			_mm_sfence();
+	}
+#endif
+	for (; i < n; i++)
+		store_pixel(dst + i * 2, pixel, 2);
+}
+
+/* 24bpp: 16 pixels (48 bytes) pattern, built from 12 bytes group of 4 pixels */
+static void fill_row24(uint8_t *dst, uint32_t pixel, int n, bool stream)
+{
+	uint8_t pattern[48];
+	int i = 0;
+
+	for (int j = 0; j < 16; j += 4)
+		store_rgb888_x4(pattern + j * 3, pixel, pixel, pixel, pixel);
+
+#if defined(__SSE2__)
+	/* at most 15 pixels to reach 16 bytes boundary (gcd(3, 16) = 1) */
+	for (; i < n && ((uintptr_t) (dst + i * 3) & (FILL_ALIGN - 1)); i++)
+		store_pixel(dst + i * 3, pixel, 3);
+
+	if (i + 16 <= n) {
+		__m128i v0 = _mm_loadu_si128((const __m128i *) (pattern +  0));
+		__m128i v1 = _mm_loadu_si128((const __m128i *) (pattern + 16));
+		__m128i v2 = _mm_loadu_si128((const __m128i *) (pattern + 32));
+
+		for (; i + 16 <= n; i += 16) {
+			fill_store(dst + i * 3 +  0, v0, stream);
+			fill_store(dst + i * 3 + 16, v1, stream);
+			fill_store(dst + i * 3 + 32, v2, stream);
+		}
+		if (stream)
+			_mm_sfence();
+	}
+#endif
+	for (; i + 4 <= n; i += 4)
+		memcpy(dst + i * 3, pattern, 12);
+	for (; i < n; i++)
+		store_pixel(dst + i * 3, pixel, 3);
+}
+
+static void fill_row32(uint8_t *dst, uint32_t pixel, int n, bool stream)
+{
+	int i = 0;
+
+#if defined(__SSE2__)
+	if (((uintptr_t) dst & 3) == 0) {
+		__m128i v = _mm_set1_epi32(pixel);
+
+		for (; i < n && ((uintptr_t) (dst + i * 4) & (FILL_ALIGN - 1)); i++)
+			store_pixel(dst + i * 4, pixel, 4);
+		for (; i + 4 <= n; i += 4)
+			fill_store(dst + i * 4, v, stream);
+		if (stream)
+			_mm_sfence();
+	}
+#endif
+	for (; i < n; i++)
+		store_pixel(dst + i * 4, pixel, 4);
+}
+
+static void fill_span(struct fb_info_t *info, uint8_t *dst, uint32_t pixel, int n, bool stream)
+{
+	stream = stream && stream_mode != STREAM_NONE && (long) n * info->bytes_per_pixel >= STREAM_MIN_SIZE;
+
+	switch (info->bytes_per_pixel) {
+	case 4:
+		fill_row32(dst, pixel, n, stream);
+		break;
+	case 3:
+		fill_row24(dst, pixel, n, stream);
+		break;
+	case 2:
+		fill_row16(dst, pixel, n, stream);
+		break;
+	default:
+		fill_row8(dst, pixel, n, stream);
+		break;
+	}
+}
+
+/* fill n pixels by pixel (already converted by color2pixel()) */
+void fill_row(struct fb_info_t *info, uint8_t *dst, uint32_t pixel, int n)
+{
+	fill_span(info, dst, pixel, n, false);
+}
+
+struct fill_job_t {
+	struct fb_info_t *info;
+	uint8_t *dst;
+	uint32_t pixel;
+	int width;
+	bool stream;                   /* dst is framebuffer memory */
+};
+
+/* fill lines [y, y + height) of rectangle */
+static void fill_band(void *arg, int y, int height)
+{
+	struct fill_job_t *job = (struct fill_job_t *) arg;
+	struct fb_info_t *info = job->info;
+	uint8_t *dst = job->dst + (long) y * info->line_length;
+
+	/* no padding between lines: fill as one long row */
+	if (job->width == info->width && info->line_length == info->width * info->bytes_per_pixel) {
+		fill_span(info, dst, job->pixel, job->width * height, job->stream);
+		return;
+	}
+
+	for (int h = 0; h < height; h++) {
+		fill_span(info, dst, job->pixel, job->width, job->stream);
+		dst += info->line_length;
+	}
+}
+
+/* fill rectangle (clipped by screen) with 24bit color */
+void fb_fill_rect(struct framebuffer_t *fb, int x, int y, int width, int height, uint32_t color)
+{
+	struct fb_info_t *info = &fb->info;
+	struct fill_job_t job;
+
+	/* clipping */
+	if (x < 0) {
+		width += x;
+		x = 0;
+	}
+	if (y < 0) {
+		height += y;
+		y = 0;
+	}
+	if (width > info->width - x)
+		width = info->width - x;
+	if (height > info->height - y)
+		height = info->height - y;
+	if (width <= 0 || height <= 0)
+		return;
+
+	job.info  = info;
+	job.dst   = fb->buf + y * info->line_length + x * info->bytes_per_pixel;
+	job.pixel = color2pixel_inline(info, color);
+	job.width = width;
+	job.stream = buf_is_device(fb);
+	fb_damage(fb, x, y, width, height);
+	stats_vram(fb, (long) width * height * info->bytes_per_pixel);
+
+	fb_pool_run(fb, fill_band, &job, height, (long) width * height * info->bytes_per_pixel);
+}
+
+void fb_clear(struct framebuffer_t *fb, uint32_t color)
+{
+	fb_fill_rect(fb, 0, 0, fb->info.width, fb->info.height, color);
+}
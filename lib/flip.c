@@ -0,0 +1,161 @@
+/* See LICENSE for licence details. */
+/* page flipping: allocate 2 or 3 pages in virtual screen (yres_virtual),
+	draw into back page (fb->buf) and pan display to it (no copy) */
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+
+#include "util.h"
+#include "yafblib.h"
+
+#if defined(__linux__)
+	#include "linux.h"
+#elif defined(__FreeBSD__)
+	#include "freebsd.h"
+#elif defined(__NetBSD__)
+	#include "netbsd.h"
+#elif defined(__OpenBSD__)
+	#include "openbsd.h"
+#endif
+
+#include "backend.h"
+#include "stream.h"
+#include "stats.h"
+#include "mapping.h"
+
+enum flip_misc {
+	FLIP_MAX_PAGES = 3,
+};
+
+static inline uint8_t *flip_page(struct framebuffer_t *fb, int page)
+{
+	return fb->fp + (long) page * fb->info.height * fb->info.line_length;
+}
+
+/* map [0, size) of framebuffer memory: mapping is extended for virtual screen, and shrunk to visible area again
+	old mapping is unmapped after new one succeeded: on failure, fp/buf/mapped_size are kept */
+bool flip_remap(struct framebuffer_t *fb, long size)
+{
+	uint8_t *fp;
+
+	if (fb->info.mapped_size == size)
+		return true;
+
+	fp = (uint8_t *) emmap(0, size, PROT_WRITE | PROT_READ, MAP_SHARED, fb->fd, 0);
+	if (fp == MAP_FAILED) {
+		logging(ERROR, "couldn't remap framebuffer (size:%ld)\n", size);
+		return false;
+	}
+	emunmap(fb->fp, fb->info.mapped_size);
+	fb->fp = fp;
+	fb->info.mapped_size = size;
+	if (prefault_enabled())
+		prefault(fb->fp, size);
+	fb->buf = fb->fp;
+	return true;
+}
+
+/* resize virtual screen (driver may refuse or adjust the value) and update sizes of fb->info */
+bool flip_set_height_virtual(struct framebuffer_t *fb, int height_virtual)
+{
+	bool ret;
+
+	stats_ioctl(fb, STATS_IOCTL_HEIGHT_VIRTUAL);
+	ret = fb->backend->set_height_virtual(fb->fd, &fb->info, height_virtual);
+	info_set_size(&fb->info);
+
+	return ret;
+}
+
+/* return false (and keep single buffering) if driver doesn't support panning */
+bool fb_flip_init(struct framebuffer_t *fb, int pages)
+{
+	struct fb_info_t *info = &fb->info;
+
+	if (pages < 2 || pages > FLIP_MAX_PAGES) {
+		logging(ERROR, "page flipping: %d pages not supported\n", pages);
+		return false;
+	}
+
+	if (fb->shadow || fb->scroll.enabled) {
+		logging(WARN, "page flipping: couldn't use with shadow buffer or hardware scrolling\n");
+		return false;
+	}
+
+	if (info->ypanstep == 0 || (info->height % info->ypanstep) != 0) {
+		logging(WARN, "page flipping: panning not supported (ypanstep:%d)\n", info->ypanstep);
+		return false;
+	}
+
+	fb->flip.height_virtual = info->height_virtual;
+
+	if (info->height_virtual < info->height * pages) {
+		if (!flip_set_height_virtual(fb, info->height * pages)) {
+			/* driver may have accepted (and clamped) new virtual resolution */
+			logging(WARN, "page flipping: couldn't allocate %d pages\n", pages);
+			flip_set_height_virtual(fb, fb->flip.height_virtual);
+			return false;
+		}
+	}
+
+	if (info->virtual_size < info->screen_size * pages) {
+		logging(WARN, "page flipping: framebuffer memory is too small\n");
+		flip_set_height_virtual(fb, fb->flip.height_virtual);
+		return false;
+	}
+
+	if (!flip_remap(fb, info->screen_size * pages)) {
+		flip_set_height_virtual(fb, fb->flip.height_virtual);
+		return false;
+	}
+
+	fb->flip.pages = pages;
+	fb->flip.front = 0;
+	fb->buf = flip_page(fb, 1);
+
+	return true;
+}
+
+/* show back page, next back page becomes drawing target
+	without page flipping, flush shadow buffer (if any) */
+bool fb_flip(struct framebuffer_t *fb)
+{
+	int back;
+
+	if (fb->flip.pages < 2) {
+		fb_flush(fb);
+		return true;
+	}
+
+	back = (fb->flip.front + 1) % fb->flip.pages;
+	stats_ioctl(fb, STATS_IOCTL_PAN);
+	if (!fb->backend->pan_display(fb->fd, &fb->info, back * fb->info.height))
+		return false;
+
+	fb->flip.front = back;
+	fb->buf = flip_page(fb, (back + 1) % fb->flip.pages);
+
+	return true;
+}
+
+/* show first page and restore virtual screen */
+void fb_flip_die(struct framebuffer_t *fb)
+{
+	if (fb->flip.pages < 2)
+		return;
+
+	stats_ioctl(fb, STATS_IOCTL_PAN);
+	fb->backend->pan_display(fb->fd, &fb->info, 0);
+	flip_set_height_virtual(fb, fb->flip.height_virtual);
+
+	fb->flip.pages = 1;
+	fb->flip.front = 0;
+	fb->buf = fb->fp;
+
+	flip_remap(fb, fb->info.screen_size);
+}
@@ -0,0 +1,249 @@
+/* See LICENSE for licence details. */
+/* glyph cache: glyphs already expanded into native pixels for each fg/bg pair
+	drawing a cached glyph is a memcpy of each row, least recently used glyph is evicted
+	when cache exceeds memory budget
+	glyph bitmap: 1 bit per pixel, MSB side is left (pixel x is bit (width - 1 - x)), width <= 32 */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "util.h"
+#include "yafblib.h"
+#include "stream.h"
+#include "stats.h"
+
+extern const unsigned int bit_mask[];
+
+enum glyph_misc {
+	GLYPH_MAX_WIDTH       = 32,
+	GLYPH_MAX_HEIGHT      = 64,
+	GLYPH_ENTRY_SIZE      = 512, /* typical size of entry (8x16 glyph, 32bpp): used for hash table size */
+	GLYPH_MIN_TABLE_SIZE  = 256,
+};
+
+static inline uint32_t glyph_hash(uint32_t code, uint32_t fg, uint32_t bg)
+{
+	return (code * 0x9E3779B1) ^ (fg * 0x85EBCA6B) ^ (bg * 0xC2B2AE35);
+}
+
+/* 24bpp: each 4 bits of bitmap select one of 16 pre-packed 12 bytes groups */
+static void glyph_render24(uint8_t *dst, int stride, const uint32_t *bitmap, int width, int height,
+	uint32_t fg_pixel, uint32_t bg_pixel)
+{
+	uint8_t groups[16][12];
+	uint32_t p[4];
+	int w;
+
+	for (int bits = 0; bits < 16; bits++) {
+		for (int j = 0; j < 4; j++)
+			p[j] = (bits >> (3 - j)) & 0x01 ? fg_pixel: bg_pixel;
+		store_rgb888_x4(groups[bits], p[0], p[1], p[2], p[3]);
+	}
+
+	for (int h = 0; h < height; h++) {
+		for (w = 0; w + 4 <= width; w += 4)
+			memcpy(dst + w * 3, groups[(bitmap[h] >> (width - 4 - w)) & 0x0F], 12);
+		for (; w < width; w++)
+			store_pixel(dst + w * 3, (bitmap[h] >> (width - 1 - w)) & 0x01 ? fg_pixel: bg_pixel, 3);
+		dst += stride;
+	}
+}
+
+static void glyph_render(struct fb_info_t *info, uint8_t *dst, int stride,
+	const uint32_t *bitmap, int width, int height, uint32_t fg, uint32_t bg)
+{
+	uint32_t fg_pixel = color2pixel_inline(info, fg), bg_pixel = color2pixel_inline(info, bg);
+	int bpp = info->bytes_per_pixel;
+
+	if (bpp == 3) {
+		glyph_render24(dst, stride, bitmap, width, height, fg_pixel, bg_pixel);
+		return;
+	}
+
+	for (int h = 0; h < height; h++) {
+		for (int w = 0; w < width; w++)
+			store_pixel(dst + w * bpp, (bitmap[h] >> (width - 1 - w)) & 0x01 ? fg_pixel: bg_pixel, bpp);
+		dst += stride;
+	}
+}
+
+static void glyph_lru_unlink(struct glyph_cache_t *cache, struct glyph_entry_t *entry)
+{
+	if (entry->lru_prev)
+		entry->lru_prev->lru_next = entry->lru_next;
+	else
+		cache->lru_head = entry->lru_next;
+
+	if (entry->lru_next)
+		entry->lru_next->lru_prev = entry->lru_prev;
+	else
+		cache->lru_tail = entry->lru_prev;
+}
+
+static void glyph_lru_push(struct glyph_cache_t *cache, struct glyph_entry_t *entry)
+{
+	entry->lru_prev = NULL;
+	entry->lru_next = cache->lru_head;
+
+	if (cache->lru_head)
+		cache->lru_head->lru_prev = entry;
+	else
+		cache->lru_tail = entry;
+	cache->lru_head = entry;
+}
+
+static void glyph_evict(struct glyph_cache_t *cache)
+{
+	struct glyph_entry_t *entry = cache->lru_tail, **p;
+
+	glyph_lru_unlink(cache, entry);
+
+	for (p = &cache->table[entry->hash & (cache->table_size - 1)]; *p; p = &(*p)->hash_next) {
+		if (*p == entry) {
+			*p = entry->hash_next;
+			break;
+		}
+	}
+
+	cache->used -= entry->size;
+	free(entry);
+}
+
+/* return cached glyph (render and insert if not found), NULL if glyph is larger than budget */
+static struct glyph_entry_t *glyph_lookup(struct glyph_cache_t *cache, struct fb_info_t *info,
+	uint32_t code, const uint32_t *bitmap, int width, int height, uint32_t fg, uint32_t bg)
+{
+	struct glyph_entry_t *entry, **bucket;
+	uint32_t hash = glyph_hash(code, fg, bg);
+	size_t size;
+
+	bucket = &cache->table[hash & (cache->table_size - 1)];
+	for (entry = *bucket; entry; entry = entry->hash_next) {
+		if (entry->code == code && entry->fg == fg && entry->bg == bg
+			&& entry->width == width && entry->height == height) {
+			cache->hits++;
+			glyph_lru_unlink(cache, entry);
+			glyph_lru_push(cache, entry);
+			return entry;
+		}
+	}
+	cache->misses++;
+
+	size = sizeof(struct glyph_entry_t) + (size_t) width * height * info->bytes_per_pixel;
+	if (size > cache->budget)
+		return NULL;
+
+	while (cache->used + size > cache->budget && cache->lru_tail)
+		glyph_evict(cache);
+
+	if ((entry = (struct glyph_entry_t *) ecalloc(1, size)) == NULL)
+		return NULL;
+
+	entry->code   = code;
+	entry->fg     = fg;
+	entry->bg     = bg;
+	entry->width  = width;
+	entry->height = height;
+	entry->hash   = hash;
+	entry->size   = size;
+	glyph_render(info, entry->pixels, width * info->bytes_per_pixel, bitmap, width, height, fg, bg);
+
+	entry->hash_next = *bucket;
+	*bucket = entry;
+	glyph_lru_push(cache, entry);
+	cache->used += size;
+
+	return entry;
+}
+
+bool fb_glyph_cache_init(struct framebuffer_t *fb, size_t budget)
+{
+	struct glyph_cache_t *cache;
+	size_t table_size = GLYPH_MIN_TABLE_SIZE;
+
+	if (fb->glyph_cache)
+		return true;
+
+	while (table_size < budget / GLYPH_ENTRY_SIZE)
+		table_size *= 2;
+
+	if ((cache = (struct glyph_cache_t *) ecalloc(1, sizeof(struct glyph_cache_t))) == NULL)
+		return false;
+
+	if ((cache->table = (struct glyph_entry_t **) ecalloc(table_size, sizeof(struct glyph_entry_t *))) == NULL) {
+		free(cache);
+		return false;
+	}
+	cache->table_size = table_size;
+	cache->budget     = budget;
+
+	fb->glyph_cache = cache;
+	return true;
+}
+
+void fb_glyph_cache_die(struct framebuffer_t *fb)
+{
+	struct glyph_cache_t *cache = fb->glyph_cache;
+
+	if (!cache)
+		return;
+
+	while (cache->lru_tail)
+		glyph_evict(cache);
+	free(cache->table);
+	free(cache);
+
+	fb->glyph_cache = NULL;
+}
+
+/* draw glyph at (x, y) (clipped): code identifies bitmap (only read when glyph is not cached) */
+void fb_draw_glyph(struct framebuffer_t *fb, int x, int y, uint32_t code,
+	const uint32_t *bitmap, int width, int height, uint32_t fg, uint32_t bg)
+{
+	struct fb_info_t *info = &fb->info;
+	struct glyph_entry_t *entry = NULL;
+	int bpp = info->bytes_per_pixel, stride, x_start, y_start, x_end, y_end;
+	uint8_t *dst;
+	const uint8_t *src;
+
+	if (width <= 0 || width > GLYPH_MAX_WIDTH || height <= 0 || height > GLYPH_MAX_HEIGHT)
+		return;
+
+	x_start = (x < 0) ? -x: 0;
+	y_start = (y < 0) ? -y: 0;
+	x_end   = (x + width > info->width) ? info->width - x: width;
+	y_end   = (y + height > info->height) ? info->height - y: height;
+	if (x_start >= x_end || y_start >= y_end)
+		return;
+
+	if (fb->glyph_cache)
+		entry = glyph_lookup(fb->glyph_cache, info, code, bitmap, width, height, fg, bg);
+
+	/* without cache (or glyph larger than budget): render visible part directly */
+	if (!entry) {
+		uint32_t rows[GLYPH_MAX_HEIGHT];
+
+		for (int h = 0; h < height; h++)
+			rows[h] = (bitmap[h] >> (width - x_end)) & bit_mask[x_end - x_start];
+		glyph_render(info, fb->buf + (y + y_start) * info->line_length + (x + x_start) * bpp,
+			info->line_length, rows + y_start, x_end - x_start, y_end - y_start, fg, bg);
+		fb_damage(fb, x + x_start, y + y_start, x_end - x_start, y_end - y_start);
+		stats_vram(fb, (long) (x_end - x_start) * (y_end - y_start) * bpp);
+		return;
+	}
+
+	stride = width * bpp;
+	src = entry->pixels + y_start * stride + x_start * bpp;
+	dst = fb->buf + (y + y_start) * info->line_length + (x + x_start) * bpp;
+
+	for (int h = y_start; h < y_end; h++) {
+		memcpy(dst, src, (x_end - x_start) * bpp);
+		src += stride;
+		dst += info->line_length;
+	}
+	fb_damage(fb, x + x_start, y + y_start, x_end - x_start, y_end - y_start);
+	stats_vram(fb, (long) (x_end - x_start) * (y_end - y_start) * bpp);
+}
@@ -15,10 +15,9 @@
 #include <unistd.h>
 
 #include "util.h"
+#include "yafblib.h"
 #include "linux.h"
 
-cmap_t *cmap, *cmap_orig;
-
 const char *fb_path = "/dev/fb0";
 
 const unsigned int bit_mask[] = {
@@ -49,6 +48,18 @@ int put_cmap(int fd, cmap_t *cmap)
 	return ioctl(fd, FBIOPUTCMAP, cmap);
 }
 
+/* upload entries [start, start + len) only: arrays of range begin at start */
+int put_cmap_range(int fd, cmap_t *cmap, int start, int len)
+{
+	struct fb_cmap range = {
+		.start = start, .len = len,
+		.red = cmap->red + start, .green = cmap->green + start, .blue = cmap->blue + start,
+		.transp = NULL,
+	};
+
+	return ioctl(fd, FBIOPUTCMAP, &range);
+}
+
 int get_cmap(int fd, cmap_t *cmap)
 {
 	return ioctl(fd, FBIOGETCMAP, cmap);
@@ -94,6 +105,11 @@ bool set_fbinfo(int fd, struct fb_info_t *info)
 	struct fb_fix_screeninfo finfo;
 	struct fb_var_screeninfo vinfo;
 
+	if (sizeof(struct fb_var_screeninfo) > sizeof(info->backend_state)) {
+		logging(FATAL, "struct fb_var_screeninfo doesn't fit in fb_info_t backend_state\n");
+		return false;
+	}
+
 	if (ioctl(fd, FBIOGET_FSCREENINFO, &finfo)) {
 		logging(ERROR, "ioctl: FBIOGET_FSCREENINFO failed\n");
 		return false;
@@ -108,9 +124,12 @@ bool set_fbinfo(int fd, struct fb_info_t *info)
 
 	info->width  = vinfo.xres;
 	info->height = vinfo.yres;
-	info->screen_size = finfo.smem_len;
+	info->memory_size = finfo.smem_len;
 	info->line_length = finfo.line_length;
 
+	info->height_virtual = vinfo.yres_virtual;
+	info->ypanstep       = finfo.ypanstep;
+
 	info->bits_per_pixel  = vinfo.bits_per_pixel;
 	info->bytes_per_pixel = my_ceil(info->bits_per_pixel, BITS_PER_BYTE);
 
@@ -123,8 +142,65 @@ bool set_fbinfo(int fd, struct fb_info_t *info)
 		if (ioctl(fd, FBIOPUT_VSCREENINFO, &vinfo))
 			logging(WARN, "couldn't reset offset (x:%d y:%d)\n", vinfo.xoffset, vinfo.yoffset);
 	}
+	memcpy(info->backend_state, &vinfo, sizeof(vinfo));
 
 	return true;
 }
 
+/* resize virtual screen for page flipping: driver may refuse or adjust the value */
+bool set_height_virtual(int fd, struct fb_info_t *info, int height_virtual)
+{
+	struct fb_fix_screeninfo finfo;
+	struct fb_var_screeninfo vinfo;
+
+	if (ioctl(fd, FBIOGET_VSCREENINFO, &vinfo)) {
+		logging(ERROR, "ioctl: FBIOGET_VSCREENINFO failed\n");
+		return false;
+	}
+
+	vinfo.yres_virtual = height_virtual;
+	vinfo.xoffset = vinfo.yoffset = 0;
+	if (ioctl(fd, FBIOPUT_VSCREENINFO, &vinfo)) {
+		logging(WARN, "couldn't set yres_virtual:%d\n", height_virtual);
+		return false;
+	}
+
+	if (ioctl(fd, FBIOGET_FSCREENINFO, &finfo)
+		|| ioctl(fd, FBIOGET_VSCREENINFO, &vinfo)) {
+		logging(ERROR, "ioctl: FBIOGET_[FV]SCREENINFO failed\n");
+		return false;
+	}
+
+	info->height_virtual = vinfo.yres_virtual;
+	info->memory_size    = finfo.smem_len;
+	info->line_length    = finfo.line_length;
+	info->ypanstep       = finfo.ypanstep;
+	memcpy(info->backend_state, &vinfo, sizeof(vinfo));
+
+	return info->height_virtual >= height_virtual;
+}
+
+/* vinfo is cached by set_fbinfo()/set_height_virtual() (only places it changes): one ioctl per flip */
+bool pan_display(int fd, struct fb_info_t *info, int yoffset)
+{
+	struct fb_var_screeninfo vinfo;
+
+	memcpy(&vinfo, info->backend_state, sizeof(vinfo));
+	vinfo.xoffset = 0;
+	vinfo.yoffset = yoffset;
+	if (ioctl(fd, FBIOPAN_DISPLAY, &vinfo)) {
+		logging(ERROR, "ioctl: FBIOPAN_DISPLAY failed (yoffset:%d)\n", yoffset);
+		return false;
+	}
+	return true;
+}
+
+/* block until next vertical blank (crtc 0) */
+bool wait_vsync(int fd)
+{
+	__u32 crtc = 0;
+
+	return ioctl(fd, FBIO_WAITFORVSYNC, &crtc) == 0;
+}
+
 #endif /* defined(__linux__) */
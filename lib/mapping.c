@@ -0,0 +1,105 @@
+/* See LICENSE for licence details. */
+/* memory mapping: only visible area of framebuffer is mapped at fb_open() (virtual screen is mapped by flip_remap()
+	when page flipping/hardware scrolling needs it), and prefaulted (first frame doesn't take page fault per page),
+	shadow/diff buffers are aligned to huge page and advised to use transparent huge pages
+	YAFB_PREFAULT=0 env disables prefault of both */
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "util.h"
+#include "yafblib.h"
+#include "mapping.h"
+
+enum mapping_misc {
+	HUGEPAGE_SIZE = 2 * 1024 * 1024, /* PMD size of x86_64/aarch64 (4KB base page) */
+};
+
+/* visible/virtual size from geometry: after set_fbinfo() and set_height_virtual() */
+void info_set_size(struct fb_info_t *info)
+{
+	info->screen_size  = (long) info->line_length * info->height;
+	info->virtual_size = (long) info->line_length * info->height_virtual;
+
+	if (info->virtual_size > info->memory_size)
+		info->virtual_size = info->memory_size;
+}
+
+bool prefault_enabled(void)
+{
+	char *env;
+
+	return (env = getenv("YAFB_PREFAULT")) == NULL || strcmp(env, "0") != 0;
+}
+
+/* populate page table of [addr, addr + size) for write */
+void prefault(uint8_t *addr, size_t size)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	volatile uint8_t *ptr;
+
+#if defined(MADV_POPULATE_WRITE)
+	if (madvise(addr, size, MADV_POPULATE_WRITE) == 0)
+		return;
+	/* old kernel, or device memory mapped by remap_pfn_range (already populated): touch pages */
+#endif
+
+	for (size_t offset = 0; offset < size; offset += page) {
+		ptr  = addr + offset;
+		*ptr = *ptr;
+	}
+}
+
+/* buffer of huge page size or more is rounded up to huge pages */
+static size_t buffer_size(size_t size)
+{
+	if (size < HUGEPAGE_SIZE)
+		return size;
+
+	return (size + HUGEPAGE_SIZE - 1) & ~((size_t) HUGEPAGE_SIZE - 1);
+}
+
+/* anonymous buffer (zero filled) for shadow/diff: return NULL if failed, free by buffer_free() with same size */
+uint8_t *buffer_alloc(size_t size)
+{
+	uint8_t *ptr, *aligned;
+	size_t len = buffer_size(size), head;
+
+	if (len < HUGEPAGE_SIZE) {
+		ptr = (uint8_t *) emmap(0, len, PROT_WRITE | PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (ptr == MAP_FAILED)
+			return NULL;
+		aligned = ptr;
+	} else {
+		/* over allocate and trim: mapping starts at huge page boundary (THP needs aligned range) */
+		ptr = (uint8_t *) emmap(0, len + HUGEPAGE_SIZE, PROT_WRITE | PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (ptr == MAP_FAILED)
+			return NULL;
+
+		aligned = (uint8_t *) (((uintptr_t) ptr + HUGEPAGE_SIZE - 1) & ~((uintptr_t) HUGEPAGE_SIZE - 1));
+		head    = aligned - ptr;
+		if (head > 0)
+			munmap(ptr, head);
+		munmap(aligned + len, HUGEPAGE_SIZE - head);
+
+#if defined(MADV_HUGEPAGE)
+		/* hint only: ignored if THP is disabled ("never") */
+		madvise(aligned, len, MADV_HUGEPAGE);
+#endif
+	}
+
+	if (prefault_enabled())
+		prefault(aligned, len);
+
+	return aligned;
+}
+
+void buffer_free(uint8_t *ptr, size_t size)
+{
+	emunmap(ptr, buffer_size(size));
+}
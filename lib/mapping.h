@@ -0,0 +1,7 @@
+/* See LICENSE for licence details. */
+/* memory mapping (mapping.c): sizes of fb_info_t, prefault of framebuffer mapping, shadow/diff buffers on huge pages */
+void info_set_size(struct fb_info_t *info);
+bool prefault_enabled(void);
+void prefault(uint8_t *addr, size_t size);
+uint8_t *buffer_alloc(size_t size);
+void buffer_free(uint8_t *ptr, size_t size);
@@ -0,0 +1,239 @@
+/* See LICENSE for licence details. */
+/* thread pool (opt-in): large operations are split into horizontal bands (whole lines)
+	bands are distributed to per thread queues, idle thread steals bands from the end of other queues
+	caller thread also works, fb_pool_run() returns after all bands are done */
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "util.h"
+#include "yafblib.h"
+
+enum pool_misc {
+	POOL_MAX_THREADS = 64,
+	POOL_BAND_SIZE   = 64 * 1024,  /* byte: band of lines (fits in L2 cache) */
+	POOL_MIN_SIZE    = 256 * 1024, /* byte: smaller operation runs on caller thread */
+	POOL_CACHE_LINE  = 64,         /* byte: alignment of queues */
+};
+
+struct pool_queue_t {
+	uint64_t range;                /* remaining bands: (begin << 32) | end */
+	uint8_t pad[POOL_CACHE_LINE - sizeof(uint64_t)]; /* one queue per cache line (array is aligned to it) */
+};
+
+struct pool_thread_t {
+	struct thread_pool_t *pool;
+	pthread_t tid;
+	int id;                        /* index of own queue */
+};
+
+struct thread_pool_t {
+	int threads;                   /* including caller thread (id 0) */
+	struct pool_thread_t *workers;
+	struct pool_queue_t *queues;
+	pthread_mutex_t lock;
+	pthread_cond_t start, done;
+	unsigned long generation;      /* incremented for each job */
+	int busy;                      /* workers not finished current job */
+	bool quit;
+	/* current job */
+	void (*func)(void *arg, int y, int height);
+	void *arg;
+	int band, height;              /* line */
+};
+
+/* take a band from front (owner) or end (thief) of queue */
+static inline bool pool_take(struct pool_queue_t *queue, bool steal, int *band)
+{
+	uint64_t range = __atomic_load_n(&queue->range, __ATOMIC_ACQUIRE), next;
+	uint32_t begin, end;
+
+	do {
+		begin = range >> 32;
+		end   = range & 0xFFFFFFFF;
+		if (begin >= end)
+			return false;
+
+		if (steal)
+			*band = --end;
+		else
+			*band = begin++;
+		next = ((uint64_t) begin << 32) | end;
+	} while (!__atomic_compare_exchange_n(&queue->range, &range, next, true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+	return true;
+}
+
+/* process own queue, then steal from others (queues are never refilled during a job) */
+static void pool_work(struct thread_pool_t *pool, int id)
+{
+	int band, y;
+
+	for (int i = 0; i < pool->threads; i++) {
+		struct pool_queue_t *queue = &pool->queues[(id + i) % pool->threads];
+
+		while (pool_take(queue, i != 0, &band)) {
+			y = band * pool->band;
+			pool->func(pool->arg, y, (y + pool->band > pool->height) ? pool->height - y: pool->band);
+		}
+	}
+}
+
+static void *pool_thread(void *arg)
+{
+	struct pool_thread_t *worker = (struct pool_thread_t *) arg;
+	struct thread_pool_t *pool = worker->pool;
+	unsigned long generation = 0;
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		while (!pool->quit && pool->generation == generation)
+			pthread_cond_wait(&pool->start, &pool->lock);
+		if (pool->quit)
+			break;
+		generation = pool->generation;
+		pthread_mutex_unlock(&pool->lock);
+
+		pool_work(pool, worker->id);
+
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->busy == 0)
+			pthread_cond_signal(&pool->done);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+static void pool_run(struct thread_pool_t *pool, void (*func)(void *arg, int y, int height), void *arg, int height, int band)
+{
+	uint64_t bands = my_ceil(height, band);
+
+	pthread_mutex_lock(&pool->lock);
+	pool->func   = func;
+	pool->arg    = arg;
+	pool->band   = band;
+	pool->height = height;
+	for (int i = 0; i < pool->threads; i++)
+		pool->queues[i].range = ((bands * i / pool->threads) << 32) | (bands * (i + 1) / pool->threads);
+	pool->generation++;
+	pool->busy = pool->threads - 1;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+
+	pool_work(pool, 0);
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->busy > 0)
+		pthread_cond_wait(&pool->done, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/* call func(arg, y, height) for lines [0, height) of operation: size is byte written by operation
+	without pool (or small operation), func is called once for all lines */
+void fb_pool_run(struct framebuffer_t *fb, void (*func)(void *arg, int y, int height), void *arg, int height, long size)
+{
+	int band = POOL_BAND_SIZE / fb->info.line_length;
+
+	if (band < 1)
+		band = 1;
+
+	if (!fb->pool || size < POOL_MIN_SIZE || height <= band) {
+		func(arg, 0, height);
+		return;
+	}
+	pool_run(fb->pool, func, arg, height, band);
+}
+
+static void pool_stop(struct thread_pool_t *pool, int started)
+{
+	pthread_mutex_lock(&pool->lock);
+	pool->quit = true;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (int i = 1; i < started; i++)
+		pthread_join(pool->workers[i].tid, NULL);
+
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->start);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->queues);
+	free(pool->workers);
+	free(pool);
+}
+
+void fb_pool_die(struct framebuffer_t *fb)
+{
+	if (!fb->pool)
+		return;
+
+	pool_stop(fb->pool, fb->pool->threads);
+	fb->pool = NULL;
+}
+
+/* queues aligned to cache line (calloc only guarantees 16 bytes): neighbouring queues never share a line */
+static struct pool_queue_t *pool_queues_alloc(int threads)
+{
+	void *ptr;
+	int ret;
+
+	if ((ret = posix_memalign(&ptr, POOL_CACHE_LINE, threads * sizeof(struct pool_queue_t))) != 0) {
+		logging(ERROR, "posix_memalign: %s\n", strerror(ret));
+		return NULL;
+	}
+	return (struct pool_queue_t *) memset(ptr, 0, threads * sizeof(struct pool_queue_t));
+}
+
+/* threads: number of threads including caller (<= 0: number of online cpus, 1: disable pool) */
+bool fb_pool_init(struct framebuffer_t *fb, int threads)
+{
+	struct thread_pool_t *pool;
+	int ret;
+
+	if (fb->pool)
+		return true;
+
+	if (threads <= 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads > POOL_MAX_THREADS)
+		threads = POOL_MAX_THREADS;
+	if (threads <= 1)
+		return true;
+
+	if ((pool = (struct thread_pool_t *) ecalloc(1, sizeof(struct thread_pool_t))) == NULL)
+		return false;
+
+	pool->threads = threads;
+	pool->workers = (struct pool_thread_t *) ecalloc(threads, sizeof(struct pool_thread_t));
+	pool->queues  = pool_queues_alloc(threads);
+	if (!pool->workers || !pool->queues) {
+		free(pool->queues);
+		free(pool->workers);
+		free(pool);
+		return false;
+	}
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->start, NULL);
+	pthread_cond_init(&pool->done, NULL);
+
+	for (int i = 1; i < threads; i++) {
+		pool->workers[i].pool = pool;
+		pool->workers[i].id   = i;
+		if ((ret = pthread_create(&pool->workers[i].tid, NULL, pool_thread, &pool->workers[i])) != 0) {
+			logging(ERROR, "pthread_create: %s\n", strerror(ret));
+			pool_stop(pool, i);
+			return false;
+		}
+	}
+
+	logging(DEBUG, "thread pool: %d threads\n", threads);
+	fb->pool = pool;
+	return true;
+}
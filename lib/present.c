@@ -0,0 +1,104 @@
+/* See LICENSE for licence details. */
+/* presentation: show frame by fb_flip() (page flip or shadow flush) with palette changes, optionally synchronized
+	to vertical blank (FBIO_WAITFORVSYNC), and account latency/missed vblanks */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "util.h"
+#include "yafblib.h"
+
+#if defined(__linux__)
+	#include "linux.h"
+#elif defined(__FreeBSD__)
+	#include "freebsd.h"
+#elif defined(__NetBSD__)
+	#include "netbsd.h"
+#elif defined(__OpenBSD__)
+	#include "openbsd.h"
+#endif
+
+#include "backend.h"
+#include "stream.h"
+#include "stats.h"
+
+enum present_misc {
+	VBLANK_MIN_INTERVAL = 1000000, /* nsec: shorter interval is not a vblank (spurious wakeup) */
+};
+
+static void present_account(struct fb_present_t *present, int64_t ready, int64_t vblank)
+{
+	int64_t latency, delta, passed;
+
+	/* frame ready -> vblank */
+	latency = vblank - ready;
+	present->latency_last   = latency;
+	present->latency_total += latency;
+	if (latency > present->latency_max)
+		present->latency_max = latency;
+	present->vblanks++;
+
+	/* shortest interval is regarded as refresh period */
+	if (present->last_vblank > 0) {
+		delta = vblank - present->last_vblank;
+		if (delta >= VBLANK_MIN_INTERVAL && (present->interval == 0 || delta < present->interval))
+			present->interval = delta;
+
+		if (present->interval > 0) {
+			passed = (delta + present->interval / 2) / present->interval;
+			if (passed > 1)
+				present->missed += passed - 1;
+		}
+	}
+	present->last_vblank = vblank;
+}
+
+/* wait for vblank: disabled at first failure (driver without FBIO_WAITFORVSYNC) */
+static void present_wait(struct framebuffer_t *fb, int64_t ready)
+{
+	struct fb_present_t *present = &fb->present;
+
+	stats_ioctl(fb, STATS_IOCTL_VSYNC);
+	if (fb->backend->wait_vsync(fb->fd)) {
+		present_account(present, ready, now_nsec());
+	} else {
+		logging(WARN, "wait_vsync not supported, present without vsync\n");
+		present->vsync_unsupported = true;
+	}
+}
+
+/* shadow flush: wait for vblank, then copy (copy starts while top of screen is scanned out)
+	page flipping: pan first (latched at next vblank), then wait for vblank before returning,
+	because new drawing target (fb->buf) is previous front page, scanned out until that vblank */
+bool fb_present(struct framebuffer_t *fb, bool vsync)
+{
+	struct fb_present_t *present = &fb->present;
+	int64_t ready = 0, start = stats_clock();
+	bool wait = vsync && !present->vsync_unsupported, flip = (fb->flip.pages > 1), palette_ok, ok;
+
+	if (wait)
+		ready = now_nsec();
+	if (wait && !flip)
+		present_wait(fb, ready);
+	present->frames++;
+
+	/* palette changes of this frame are applied together with it */
+	palette_ok = fb_palette_commit(fb);
+
+	ok = fb_flip(fb) && palette_ok;
+	if (wait && flip)
+		present_wait(fb, ready);
+	stats_hist(fb->stats.present_hist, start);
+
+	return ok;
+}
+
+void fb_present_reset(struct framebuffer_t *fb)
+{
+	bool vsync_unsupported = fb->present.vsync_unsupported;
+
+	memset(&fb->present, 0, sizeof(struct fb_present_t));
+	fb->present.vsync_unsupported = vsync_unsupported;
+}
@@ -0,0 +1,381 @@
+/* See LICENSE for licence details. */
+/* shadow buffer: drawing target on system RAM (native pixel format, same line_length as framebuffer)
+	drawn area is recorded by tiles, fb_flush() copies only dirty tiles to framebuffer
+	frame diff (optional): previous flushed frame is kept in RAM, fb_flush() compares dirty area
+	by 64 byte blocks and writes only changed spans to framebuffer */
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+
+#if defined(__SSE2__)
+	#include <emmintrin.h>
+#endif
+
+#include "util.h"
+#include "yafblib.h"
+#include "cpu.h"
+#include "stream.h"
+#include "stats.h"
+#include "mapping.h"
+
+enum shadow_misc {
+	DAMAGE_TILE_WIDTH  = 64, /* pixel */
+	DAMAGE_TILE_HEIGHT = 16, /* line */
+	DIFF_BLOCK_SIZE    = 64, /* byte */
+};
+
+/* compare aligned 64 byte block: return true if changed */
+static inline bool diff_block_base(const uint8_t *new, const uint8_t *old)
+{
+#if defined(__SSE2__)
+	__m128i eq = _mm_and_si128(
+		_mm_and_si128(
+			_mm_cmpeq_epi8(_mm_load_si128((const __m128i *) new), _mm_load_si128((const __m128i *) old)),
+			_mm_cmpeq_epi8(_mm_load_si128((const __m128i *) (new + 16)), _mm_load_si128((const __m128i *) (old + 16)))),
+		_mm_and_si128(
+			_mm_cmpeq_epi8(_mm_load_si128((const __m128i *) (new + 32)), _mm_load_si128((const __m128i *) (old + 32))),
+			_mm_cmpeq_epi8(_mm_load_si128((const __m128i *) (new + 48)), _mm_load_si128((const __m128i *) (old + 48)))));
+	return _mm_movemask_epi8(eq) != 0xFFFF;
+#else
+	return memcmp(new, old, DIFF_BLOCK_SIZE) != 0;
+#endif
+}
+
+/* return number of leading blocks in same state (changed or not) */
+static long diff_run_base(const uint8_t *new, const uint8_t *old, long blocks, bool changed)
+{
+	long i = 0;
+
+	while (i < blocks && diff_block_base(new + i * DIFF_BLOCK_SIZE, old + i * DIFF_BLOCK_SIZE) == changed)
+		i++;
+	return i;
+}
+
+#if defined(CPU_DISPATCH)
+TARGET_AVX2
+static inline bool diff_block_avx2(const uint8_t *new, const uint8_t *old)
+{
+	__m256i x0 = _mm256_xor_si256(_mm256_load_si256((const __m256i *) new),
+		_mm256_load_si256((const __m256i *) old));
+	__m256i x1 = _mm256_xor_si256(_mm256_load_si256((const __m256i *) (new + 32)),
+		_mm256_load_si256((const __m256i *) (old + 32)));
+	x0 = _mm256_or_si256(x0, x1);
+	return !_mm256_testz_si256(x0, x0);
+}
+
+TARGET_AVX2
+static long diff_run_avx2(const uint8_t *new, const uint8_t *old, long blocks, bool changed)
+{
+	long i = 0;
+
+	while (i < blocks && diff_block_avx2(new + i * DIFF_BLOCK_SIZE, old + i * DIFF_BLOCK_SIZE) == changed)
+		i++;
+	return i;
+}
+
+/* one 512bit vector per block */
+TARGET_AVX512
+static inline bool diff_block_avx512(const uint8_t *new, const uint8_t *old)
+{
+	__m512i x = _mm512_xor_si512(_mm512_load_si512((const void *) new), _mm512_load_si512((const void *) old));
+	return _mm512_test_epi64_mask(x, x) != 0;
+}
+
+TARGET_AVX512
+static long diff_run_avx512(const uint8_t *new, const uint8_t *old, long blocks, bool changed)
+{
+	long i = 0;
+
+	while (i < blocks && diff_block_avx512(new + i * DIFF_BLOCK_SIZE, old + i * DIFF_BLOCK_SIZE) == changed)
+		i++;
+	return i;
+}
+#endif
+
+/* kernel for running cpu (selected by diff_dispatch()) */
+static long (*diff_run_kernel)(const uint8_t *new, const uint8_t *old, long blocks, bool changed) = diff_run_base;
+
+void diff_dispatch(enum cpu_level level)
+{
+	diff_run_kernel = diff_run_base;
+
+#if defined(CPU_DISPATCH)
+	if (level >= CPU_AVX512)
+		diff_run_kernel = diff_run_avx512;
+	else if (level >= CPU_AVX2)
+		diff_run_kernel = diff_run_avx2;
+#else
+	(void) level;
+#endif
+}
+
+static inline long diff_span(uint8_t *dst, uint8_t *old, const uint8_t *new, long start, long end)
+{
+	stream_copy(dst + start, new + start, end - start);
+	memcpy(old + start, new + start, end - start);
+	return end - start;
+}
+
+/* copy changed spans of [offset, offset + size) from shadow buffer to framebuffer (and previous frame)
+	blocks are aligned to buffer (shadow and previous frame are page aligned),
+	unaligned head and tail are compared by memcmp */
+static void diff_copy(struct framebuffer_t *fb, long offset, long size)
+{
+	const uint8_t *new = fb->shadow + offset;
+	uint8_t *old = fb->diff.prev + offset, *dst = fb->fp + offset;
+	long pos, len, blocks, start = -1, written = 0;
+
+	len = (DIFF_BLOCK_SIZE - offset % DIFF_BLOCK_SIZE) % DIFF_BLOCK_SIZE;
+	if (len > size)
+		len = size;
+	if (len > 0 && memcmp(new, old, len) != 0)
+		start = 0;
+	pos = len;
+
+	/* runs of changed and unchanged blocks alternate: start >= 0 while in changed span */
+	for (blocks = (size - pos) / DIFF_BLOCK_SIZE; blocks > 0; blocks -= len) {
+		len  = diff_run_kernel(new + pos, old + pos, blocks, start >= 0);
+		pos += len * DIFF_BLOCK_SIZE;
+		if (len == blocks)
+			break;
+
+		if (start >= 0) {
+			written += diff_span(dst, old, new, start, pos);
+			start = -1;
+		} else {
+			start = pos;
+		}
+	}
+
+	if (pos < size) {
+		if (memcmp(new + pos, old + pos, size - pos) != 0) {
+			if (start < 0)
+				start = pos;
+		} else if (start >= 0) {
+			written += diff_span(dst, old, new, start, pos);
+			start = -1;
+		}
+	}
+	if (start >= 0)
+		written += diff_span(dst, old, new, start, size);
+
+	__atomic_add_fetch(&fb->diff.compared, size, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&fb->diff.written, written, __ATOMIC_RELAXED);
+}
+
+/* write [offset, offset + size) of shadow buffer to framebuffer */
+static inline void flush_copy(struct framebuffer_t *fb, long offset, long size)
+{
+	if (fb->diff.prev)
+		diff_copy(fb, offset, size);
+	else
+		stream_copy(fb->fp + offset, fb->shadow + offset, size);
+}
+
+/* mark rectangle (clipped by screen) as dirty: drawing functions call this after writing fb->buf */
+void fb_damage(struct framebuffer_t *fb, int x, int y, int width, int height)
+{
+	struct fb_damage_t *damage = &fb->damage;
+	int col_start, col_end, row_start, row_end;
+
+	if (!fb->shadow)
+		return;
+
+	if (x < 0) {
+		width += x;
+		x = 0;
+	}
+	if (y < 0) {
+		height += y;
+		y = 0;
+	}
+	if (width > fb->info.width - x)
+		width = fb->info.width - x;
+	if (height > fb->info.height - y)
+		height = fb->info.height - y;
+	if (width <= 0 || height <= 0)
+		return;
+
+	col_start = x / DAMAGE_TILE_WIDTH;
+	col_end   = (x + width - 1) / DAMAGE_TILE_WIDTH;
+	row_start = y / DAMAGE_TILE_HEIGHT;
+	row_end   = (y + height - 1) / DAMAGE_TILE_HEIGHT;
+
+	for (int row = row_start; row <= row_end; row++) {
+		for (int col = col_start; col <= col_end; col++) {
+			if (!damage->tiles[row * damage->cols + col]) {
+				damage->tiles[row * damage->cols + col] = true;
+				damage->count++;
+			}
+		}
+	}
+}
+
+void fb_damage_all(struct framebuffer_t *fb)
+{
+	fb_damage(fb, 0, 0, fb->info.width, fb->info.height);
+}
+
+static void flush_band(void *arg, int y, int height)
+{
+	struct framebuffer_t *fb = (struct framebuffer_t *) arg;
+	long offset = (long) y * fb->info.line_length;
+
+	flush_copy(fb, offset, (long) height * fb->info.line_length);
+}
+
+/* copy dirty tiles of shadow buffer to framebuffer: horizontally adjacent tiles are copied at once */
+void fb_flush(struct framebuffer_t *fb)
+{
+	struct fb_info_t *info = &fb->info;
+	struct fb_damage_t *damage = &fb->damage;
+	int col, col_end, x, y, width, height;
+	long offset, size, copied = 0;
+	unsigned long written = fb->diff.written;
+	int64_t start;
+
+	if (!fb->shadow || damage->count == 0)
+		return;
+	start = stats_clock();
+
+	/* whole screen is dirty */
+	if (damage->count == damage->cols * damage->rows) {
+		copied = (long) info->line_length * info->height;
+		fb_pool_run(fb, flush_band, fb, info->height, copied);
+		goto flush_done;
+	}
+
+	for (int row = 0; row < damage->rows; row++) {
+		y      = row * DAMAGE_TILE_HEIGHT;
+		height = (y + DAMAGE_TILE_HEIGHT > info->height) ? info->height - y: DAMAGE_TILE_HEIGHT;
+
+		for (col = 0; col < damage->cols; col = col_end) {
+			if (!damage->tiles[row * damage->cols + col]) {
+				col_end = col + 1;
+				continue;
+			}
+
+			for (col_end = col + 1; col_end < damage->cols; col_end++) {
+				if (!damage->tiles[row * damage->cols + col_end])
+					break;
+			}
+
+			x     = col * DAMAGE_TILE_WIDTH;
+			width = (col_end * DAMAGE_TILE_WIDTH > info->width) ? info->width - x: (col_end - col) * DAMAGE_TILE_WIDTH;
+
+			offset = (long) y * info->line_length + x * info->bytes_per_pixel;
+			size   = (long) width * info->bytes_per_pixel;
+			copied += size * height;
+			for (int h = 0; h < height; h++) {
+				flush_copy(fb, offset, size);
+				offset += info->line_length;
+			}
+		}
+	}
+
+flush_done:
+	memset(damage->tiles, 0, damage->cols * damage->rows);
+	damage->count = 0;
+
+	/* frame diff writes only changed spans of copied area */
+	stats_add(&fb->stats.vram_bytes, fb->diff.prev ? fb->diff.written - written: (unsigned long) copied);
+	stats_add(&fb->stats.flushes, 1);
+	stats_hist(fb->stats.flush_hist, start);
+}
+
+void fb_diff_die(struct framebuffer_t *fb)
+{
+	if (!fb->diff.prev)
+		return;
+
+	buffer_free(fb->diff.prev, fb->info.screen_size);
+	fb->diff.prev = NULL;
+}
+
+void fb_shadow_die(struct framebuffer_t *fb)
+{
+	if (!fb->shadow)
+		return;
+
+	fb_diff_die(fb);
+
+	buffer_free(fb->shadow, fb->info.screen_size);
+	free(fb->damage.tiles);
+
+	fb->shadow = NULL;
+	fb->damage.tiles = NULL;
+	fb->buf = fb->fp;
+}
+
+/* allocate shadow buffer (initialized by current framebuffer content) and switch drawing target */
+bool fb_shadow_init(struct framebuffer_t *fb)
+{
+	struct fb_damage_t *damage = &fb->damage;
+	size_t size = fb->info.screen_size;
+	int64_t start;
+
+	if (fb->shadow)
+		return true;
+
+	if (fb->flip.pages > 1 || fb->scroll.enabled) {
+		logging(WARN, "shadow buffer: couldn't use with page flipping or hardware scrolling\n");
+		return false;
+	}
+
+	start = stats_clock();
+	damage->cols  = my_ceil(fb->info.width, DAMAGE_TILE_WIDTH);
+	damage->rows  = my_ceil(fb->info.height, DAMAGE_TILE_HEIGHT);
+	damage->count = 0;
+
+	if ((damage->tiles = (bool *) ecalloc(damage->cols * damage->rows, sizeof(bool))) == NULL)
+		return false;
+
+	if ((fb->shadow = buffer_alloc(size)) == NULL) {
+		free(damage->tiles);
+		damage->tiles = NULL;
+		return false;
+	}
+	stream_read(fb->shadow, fb->fp, size);
+	stats_phase(fb, STATS_PHASE_SHADOW, start);
+
+	fb->buf = fb->shadow;
+	return true;
+}
+
+/* enable frame diff (and shadow buffer): previous frame is initialized by current framebuffer content */
+bool fb_diff_init(struct framebuffer_t *fb)
+{
+	size_t size = fb->info.screen_size;
+	int64_t start;
+	bool shadow_enabled = (fb->shadow == NULL);
+
+	if (fb->diff.prev)
+		return true;
+
+	if (!fb_shadow_init(fb))
+		return false;
+
+	start = stats_clock();
+	if ((fb->diff.prev = buffer_alloc(size)) == NULL) {
+		/* don't leave shadow buffer enabled by this call */
+		if (shadow_enabled)
+			fb_shadow_die(fb);
+		return false;
+	}
+
+	/* shadow buffer just copied from framebuffer has same content (and is cached),
+		existing one may have unflushed drawing: read framebuffer memory by streaming loads */
+	if (shadow_enabled)
+		memcpy(fb->diff.prev, fb->shadow, size);
+	else
+		stream_read(fb->diff.prev, fb->fp, size);
+	stats_phase(fb, STATS_PHASE_DIFF, start);
+
+	fb->diff.compared = fb->diff.written = 0;
+	return true;
+}
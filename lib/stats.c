@@ -0,0 +1,26 @@
+/* See LICENSE for licence details. */
+/* instrumentation: snapshot of fb->stats (updated by inline functions of stats.h) */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "util.h"
+#include "yafblib.h"
+
+/* copy of current values (all zero if built with YAFB_NO_STATS) */
+void fb_stats_snapshot(struct framebuffer_t *fb, struct fb_stats_t *stats)
+{
+	*stats = fb->stats;
+}
+
+/* clear counters and histograms (init phase timings are kept) */
+void fb_stats_reset(struct framebuffer_t *fb)
+{
+	int64_t init_phase[STATS_PHASE_NUM];
+
+	memcpy(init_phase, fb->stats.init_phase, sizeof(init_phase));
+	memset(&fb->stats, 0, sizeof(struct fb_stats_t));
+	memcpy(fb->stats.init_phase, init_phase, sizeof(init_phase));
+}
@@ -0,0 +1,23 @@
+/* See LICENSE for licence details. */
+/* streaming copy (stream.c): non-temporal stores to (and loads from) framebuffer memory */
+enum stream_misc {
+	STREAM_MIN_SIZE = 256, /* byte: smaller copy uses memcpy */
+};
+
+enum stream_mode {
+	STREAM_NONE = 0,
+	STREAM_SSE2,
+	STREAM_AVX2,
+	STREAM_AVX512,
+};
+
+extern enum stream_mode stream_mode;
+
+void stream_copy(uint8_t *dst, const uint8_t *src, size_t size);
+void stream_read(uint8_t *dst, const uint8_t *src, size_t size);
+
+/* drawing target is framebuffer memory (not shadow buffer): bulk writes should be streamed */
+static inline bool buf_is_device(struct framebuffer_t *fb)
+{
+	return fb->buf != fb->shadow;
+}
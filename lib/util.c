@@ -7,32 +7,101 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "util.h"
+#include "yafblib.h"
+
+/* error functions
+	messages below log_level are discarded before formatting (YAFB_LOG env or fb_log_set_level())
+	after fb_log_ring_init(), messages are formatted into lock-free ring buffer on memory instead of
+	unbuffered stderr, and written out by fb_log_ring_drain() (caller or another thread) */
+enum log_misc {
+	LOG_MESSAGE_SIZE = 240,     /* bytes: longer message is truncated in ring buffer */
+	LOG_RING_MAX     = 1 << 16, /* records */
+};
+
+struct log_record_t {
+	unsigned long seq; /* position + 1: written, position (+ size): free */
+	enum loglevel level;
+	char message[LOG_MESSAGE_SIZE];
+};
+
+/* bounded multi-producer queue: producers claim position by CAS of head,
+	and publish record by seq, single consumer reads from tail */
+struct log_ring_t {
+	struct log_record_t *records;
+	unsigned long size;    /* power of 2 */
+	unsigned long head;    /* next position to write */
+	unsigned long tail;    /* next position to read */
+	unsigned long dropped; /* messages lost because ring buffer was full */
+};
+
+static const char *loglevel2str[] = {
+	[DEBUG] = "DEBUG",
+	[WARN]  = "WARN",
+	[ERROR] = "ERROR",
+	[FATAL] = "FATAL",
+};
+
+/* debug message is available on verbose mode by default
+	both are accessed atomically: level/sink may be changed while other threads are logging */
+static enum loglevel log_level = VERBOSE ? DEBUG: WARN;
+static struct log_ring_t *log_ring = NULL;
+
+/* never blocks: message is dropped if ring buffer is full */
+static bool log_ring_push(struct log_ring_t *ring, enum loglevel loglevel, const char *format, va_list arg)
+{
+	struct log_record_t *record;
+	unsigned long pos, seq;
+
+	pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+	for (;;) {
+		record = &ring->records[pos & (ring->size - 1)];
+		seq    = __atomic_load_n(&record->seq, __ATOMIC_ACQUIRE);
+
+		if (seq == pos) {
+			/* free: claim it (pos is reloaded on failure) */
+			if (__atomic_compare_exchange_n(&ring->head, &pos, pos + 1,
+				true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if ((long) (seq - pos) < 0) {
+			/* full: record of previous round is not read yet */
+			__atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+			return false;
+		} else {
+			/* claimed by another producer */
+			pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+		}
+	}
+
+	record->level = loglevel;
+	vsnprintf(record->message, LOG_MESSAGE_SIZE, format, arg);
+	__atomic_store_n(&record->seq, pos + 1, __ATOMIC_RELEASE);
+
+	return true;
+}
 
-/* error functions */
 void logging(enum loglevel loglevel, char *format, ...)
 {
 	va_list arg;
-	const char *loglevel2str[] = {
-		[DEBUG] = "DEBUG",
-		[WARN]  = "WARN",
-		[ERROR] = "ERROR",
-		[FATAL] = "FATAL",
-	};
-
-	/* debug message is available on verbose mode */
-	if ((loglevel == DEBUG) && (VERBOSE == false))
-		return;
+	struct log_ring_t *ring;
 
-	fprintf(stderr, ">>%s<<\t", loglevel2str[loglevel]);
+	if (loglevel < __atomic_load_n(&log_level, __ATOMIC_RELAXED))
+		return;
 
 	va_start(arg, format);
-	vfprintf(stderr, format, arg);
+	if ((ring = __atomic_load_n(&log_ring, __ATOMIC_ACQUIRE)) != NULL) {
+		log_ring_push(ring, loglevel, format, arg);
+	} else {
+		fprintf(stderr, ">>%s<<\t", loglevel2str[loglevel]);
+		vfprintf(stderr, format, arg);
+	}
 	va_end(arg);
 }
 
@@ -124,3 +193,119 @@ int my_ceil(int val, int div)
 	else
 		return (val + div - 1) / div;
 }
+
+/* monotonic clock (nsec) */
+int64_t now_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* log level and ring buffer sink */
+/* name: "debug", "warn", "error" or "fatal" (case insensitive) */
+bool fb_log_set_level(const char *name)
+{
+	for (int i = DEBUG; i <= FATAL; i++) {
+		if (strcasecmp(name, loglevel2str[i]) == 0) {
+			__atomic_store_n(&log_level, i, __ATOMIC_RELAXED);
+			return true;
+		}
+	}
+	logging(WARN, "unknown log level \"%s\", ignored\n", name);
+	return false;
+}
+
+/* read YAFB_LOG env (called by fb_open()) */
+void log_init(void)
+{
+	char *env;
+
+	if ((env = getenv("YAFB_LOG")) != NULL)
+		fb_log_set_level(env);
+}
+
+/* records: rounded up to power of 2 */
+bool fb_log_ring_init(int records)
+{
+	struct log_ring_t *ring, *expected = NULL;
+	unsigned long size = 1;
+
+	if (__atomic_load_n(&log_ring, __ATOMIC_ACQUIRE))
+		return true;
+
+	if (records <= 0 || records > LOG_RING_MAX) {
+		logging(ERROR, "invalid log ring size %d (max:%d)\n", records, LOG_RING_MAX);
+		return false;
+	}
+
+	while (size < (unsigned long) records)
+		size <<= 1;
+
+	if ((ring = (struct log_ring_t *) ecalloc(1, sizeof(struct log_ring_t))) == NULL)
+		return false;
+
+	if ((ring->records = (struct log_record_t *) ecalloc(size, sizeof(struct log_record_t))) == NULL) {
+		free(ring);
+		return false;
+	}
+
+	ring->size = size;
+	for (unsigned long i = 0; i < size; i++)
+		ring->records[i].seq = i;
+
+	/* concurrent init: first ring is published, loser frees its own (never seen by producers) */
+	if (!__atomic_compare_exchange_n(&log_ring, &expected, ring, false, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+		free(ring->records);
+		free(ring);
+	}
+	return true;
+}
+
+/* write stored messages to fp: only one thread may drain at a time
+	return number of written messages (count of dropped messages is reported as WARN line) */
+int fb_log_ring_drain(FILE *fp)
+{
+	struct log_ring_t *ring = __atomic_load_n(&log_ring, __ATOMIC_ACQUIRE);
+	struct log_record_t *record;
+	unsigned long dropped;
+	int count = 0;
+
+	if (!ring)
+		return 0;
+
+	for (;;) {
+		record = &ring->records[ring->tail & (ring->size - 1)];
+		if (__atomic_load_n(&record->seq, __ATOMIC_ACQUIRE) != ring->tail + 1)
+			break;
+
+		fprintf(fp, ">>%s<<\t%s", loglevel2str[record->level], record->message);
+
+		/* release record for next round */
+		__atomic_store_n(&record->seq, ring->tail + ring->size, __ATOMIC_RELEASE);
+		ring->tail++;
+		count++;
+	}
+
+	if ((dropped = __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED)) > 0)
+		fprintf(fp, ">>%s<<\tlog ring: %lu messages dropped\n", loglevel2str[WARN], dropped);
+
+	return count;
+}
+
+/* drain remaining messages to stderr, and write to stderr directly again
+	no other thread may be logging or draining */
+void fb_log_ring_die(void)
+{
+	struct log_ring_t *ring = log_ring;
+
+	if (!ring)
+		return;
+
+	fb_log_ring_drain(stderr);
+	__atomic_store_n(&log_ring, NULL, __ATOMIC_RELEASE);
+
+	free(ring->records);
+	free(ring);
+}
@@ -2,6 +2,11 @@
 /* error functions */
 enum debug {
 	VERBOSE = false,
+#if defined(YAFB_NO_STATS)
+	STATS   = false, /* instrumentation is removed at compile time (see stats.h) */
+#else
+	STATS   = true,
+#endif
 };
 
 enum loglevel {
@@ -12,6 +17,7 @@ enum loglevel {
 };
 
 void logging(enum loglevel loglevel, char *format, ...);
+void log_init(void);
 
 /* wrapper of C functions */
 int eopen(const char *path, int flag);
@@ -24,3 +30,4 @@ void *ecalloc(size_t nmemb, size_t size);
 
 /* other functions */
 int my_ceil(int val, int div);
+int64_t now_nsec(void);
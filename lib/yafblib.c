@@ -1,6 +1,7 @@
 /* See LICENSE for licence details. */
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdbool.h>
@@ -13,6 +14,7 @@
 #include <unistd.h>
 
 #include "util.h"
+#include "yafblib.h"
 
 #if defined(__linux__)
 	#include "linux.h"
@@ -24,16 +26,43 @@
 	#include "openbsd.h"
 #endif
 
+#include "backend.h"
+#include "cpu.h"
+#include "stream.h"
+#include "stats.h"
+#include "mapping.h"
+
 /* prototype defined in {linux,freebsd,netbsd,openbsd}.c */
 void alloc_cmap(cmap_t *cmap, int colors);
 int put_cmap(int fd, cmap_t *cmap);
+int put_cmap_range(int fd, cmap_t *cmap, int start, int len);
 int get_cmap(int fd, cmap_t *cmap);
 bool set_fbinfo(int fd, struct fb_info_t *info);
+bool set_height_virtual(int fd, struct fb_info_t *info, int height_virtual);
+bool pan_display(int fd, struct fb_info_t *info, int yoffset);
+bool wait_vsync(int fd);
 
 /* variables defined in {linux,freebsd,netbsd,openbsd}.c */
 extern const unsigned int bit_mask[];
 extern const char *fb_path;
-extern cmap_t *cmap, *cmap_orig;
+
+/* native backend: os specific ioctl */
+static int native_open(const char *path)
+{
+	return eopen(path, O_RDWR);
+}
+
+const struct fb_backend_t fb_backend_native = {
+	.name       = "native",
+	.open       = native_open,
+	.set_fbinfo = set_fbinfo,
+	.put_cmap   = put_cmap,
+	.put_cmap_range = put_cmap_range,
+	.get_cmap   = get_cmap,
+	.set_height_virtual = set_height_virtual,
+	.pan_display        = pan_display,
+	.wait_vsync         = wait_vsync,
+};
 
 /* common framebuffer functions */
 static void cmap_die(cmap_t *cmap)
@@ -67,10 +96,11 @@ static cmap_t *cmap_create(int colors)
 	return cmap;
 }
 
-int cmap_update(int fd, cmap_t *cmap)
+int cmap_update(struct framebuffer_t *fb, cmap_t *cmap)
 {
 	if (cmap) {
-		if (put_cmap(fd, cmap)) {
+		stats_ioctl(fb, STATS_IOCTL_PUT_CMAP);
+		if (fb->backend->put_cmap(fb->fd, cmap)) {
 			logging(ERROR, "put_cmap failed\n");
 			return false;
 		}
@@ -78,17 +108,19 @@ int cmap_update(int fd, cmap_t *cmap)
 	return 1;
 }
 
-static bool cmap_save(int fd, cmap_t *cmap)
+static bool cmap_save(struct framebuffer_t *fb, cmap_t *cmap)
 {
-	if (get_cmap(fd, cmap)) {
+	stats_ioctl(fb, STATS_IOCTL_GET_CMAP);
+	if (fb->backend->get_cmap(fb->fd, cmap)) {
 		logging(WARN, "get_cmap failed\n");
 		return false;
 	}
 	return true;
 }
 
-static bool cmap_init(int fd, struct fb_info_t *info, cmap_t *cmap, int colors, int length)
+static bool cmap_init(struct framebuffer_t *fb, cmap_t *cmap, int colors, int length)
 {
+	struct fb_info_t *info = &fb->info;
 	uint16_t r, g, b, r_index, g_index, b_index;
 
 	for (int i = 0; i < colors; i++) {
@@ -120,30 +152,51 @@ static bool cmap_init(int fd, struct fb_info_t *info, cmap_t *cmap, int colors,
 		}
 	}
 
-	if (!cmap_update(fd, cmap))
+	if (!cmap_update(fb, cmap))
 		return false;
 
 	return true;
 }
 
-uint32_t color2pixel(struct fb_info_t *info, uint32_t color)
+static inline bool bitfield_equal(struct bitfield_t *bf, int offset, int length)
 {
-	uint32_t r, g, b;
-
-	r = bit_mask[BITS_PER_RGB] & (color >> (BITS_PER_RGB * 2));
-	g = bit_mask[BITS_PER_RGB] & (color >>  BITS_PER_RGB);
-	b = bit_mask[BITS_PER_RGB] & (color >>  0);
+	return bf->offset == offset && bf->length == length;
+}
 
-	r = r >> (BITS_PER_RGB - info->red.length);
-	g = g >> (BITS_PER_RGB - info->green.length);
-	b = b >> (BITS_PER_RGB - info->blue.length);
+/* must be called after bitfields are fixed (init_indexcolor() overwrites them in pseudocolor) */
+static enum fb_format get_format(struct fb_info_t *info)
+{
+	struct bitfield_t *r = &info->red, *g = &info->green, *b = &info->blue;
 
-	return (r << info->red.offset)
-			+ (g << info->green.offset)
-			+ (b << info->blue.offset);
+	switch (info->bits_per_pixel) {
+	case 32:
+		if (bitfield_equal(r, 16, 8) && bitfield_equal(g, 8, 8) && bitfield_equal(b, 0, 8))
+			return YAFT_FB_FORMAT_XRGB8888;
+		if (bitfield_equal(r, 0, 8) && bitfield_equal(g, 8, 8) && bitfield_equal(b, 16, 8))
+			return YAFT_FB_FORMAT_XBGR8888;
+		break;
+	case 24:
+		if (bitfield_equal(r, 16, 8) && bitfield_equal(g, 8, 8) && bitfield_equal(b, 0, 8))
+			return YAFT_FB_FORMAT_RGB888;
+		break;
+	case 16:
+		if (bitfield_equal(r, 11, 5) && bitfield_equal(g, 5, 6) && bitfield_equal(b, 0, 5))
+			return YAFT_FB_FORMAT_RGB565;
+		/* fall through */
+	case 15:
+		if (bitfield_equal(r, 10, 5) && bitfield_equal(g, 5, 5) && bitfield_equal(b, 0, 5))
+			return YAFT_FB_FORMAT_RGB555;
+		break;
+	case 8:
+		if (bitfield_equal(r, 5, 3) && bitfield_equal(g, 2, 3) && bitfield_equal(b, 0, 2))
+			return YAFT_FB_FORMAT_RGB332;
+		break;
+	default:
+		break;
+	}
+	return YAFT_FB_FORMAT_GENERIC;
 }
 
-
 static bool init_truecolor(struct fb_info_t *info, cmap_t **cmap, cmap_t **cmap_orig)
 {
 	switch(info->bits_per_pixel) {
@@ -162,8 +215,9 @@ static bool init_truecolor(struct fb_info_t *info, cmap_t **cmap, cmap_t **cmap_
 	return true;
 }
 
-static bool init_indexcolor(int fd, struct fb_info_t *info, cmap_t **cmap, cmap_t **cmap_orig)
+static bool init_indexcolor(struct framebuffer_t *fb, cmap_t **cmap, cmap_t **cmap_orig)
 {
+	struct fb_info_t *info = &fb->info;
 	int colors, max_length;
 
 	if (info->visual == YAFT_FB_VISUAL_DIRECTCOLOR) {
@@ -215,14 +269,15 @@ static bool init_indexcolor(int fd, struct fb_info_t *info, cmap_t **cmap, cmap_
 	if (!(*cmap) || !(*cmap_orig))
 		goto cmap_init_err;
 
-	if (!cmap_save(fd, *cmap_orig)) {
+	if (!cmap_save(fb, *cmap_orig)) {
 		logging(WARN, "couldn't save original cmap\n");
 		cmap_die(*cmap_orig);
 		*cmap_orig = NULL;
 	}
 
-	if (!cmap_init(fd, info, *cmap, colors, max_length))
+	if (!cmap_init(fb, *cmap, colors, max_length))
 		goto cmap_init_err;
+	fb->palette.colors = colors;
 
 	return true;
 
@@ -232,6 +287,16 @@ cmap_init_err:
 	return false;
 }
 
+static const char *format_str[] = {
+	[YAFT_FB_FORMAT_GENERIC]  = "YAFT_FB_FORMAT_GENERIC",
+	[YAFT_FB_FORMAT_XRGB8888] = "YAFT_FB_FORMAT_XRGB8888",
+	[YAFT_FB_FORMAT_XBGR8888] = "YAFT_FB_FORMAT_XBGR8888",
+	[YAFT_FB_FORMAT_RGB888]   = "YAFT_FB_FORMAT_RGB888",
+	[YAFT_FB_FORMAT_RGB565]   = "YAFT_FB_FORMAT_RGB565",
+	[YAFT_FB_FORMAT_RGB555]   = "YAFT_FB_FORMAT_RGB555",
+	[YAFT_FB_FORMAT_RGB332]   = "YAFT_FB_FORMAT_RGB332",
+};
+
 static void fb_print_info(struct fb_info_t *info)
 {
 	const char *type_str[] = {
@@ -251,37 +316,78 @@ static void fb_print_info(struct fb_info_t *info)
 	logging(DEBUG, "\tred(off:%d len:%d) green(off:%d len:%d) blue(off:%d len:%d)\n",
 		info->red.offset, info->red.length, info->green.offset, info->green.length, info->blue.offset, info->blue.length);
 	logging(DEBUG, "\tresolution %dx%d\n", info->width, info->height);
-	logging(DEBUG, "\tscreen size:%ld line length:%d\n", info->screen_size, info->line_length);
+	logging(DEBUG, "\tscreen size:%ld virtual size:%ld memory size:%ld line length:%d\n",
+		info->screen_size, info->virtual_size, info->memory_size, info->line_length);
+	logging(DEBUG, "\tvirtual height:%d ypanstep:%d\n", info->height_virtual, info->ypanstep);
 	logging(DEBUG, "\tbits_per_pixel:%d bytes_per_pixel:%d\n", info->bits_per_pixel, info->bytes_per_pixel);
 	logging(DEBUG, "\ttype:%s\n", type_str[info->type]);
 	logging(DEBUG, "\tvisual:%s\n", visual_str[info->visual]);
 }
 
-bool fb_init(struct framebuffer_t *fb)
+/* process-wide setup (log level, SIMD kernels): done once, even if framebuffers are opened by several threads */
+static pthread_once_t fb_once = PTHREAD_ONCE_INIT;
+
+static void fb_once_init(void)
 {
-	extern const char *fb_path;               /* defined in conf.h */
-	const char *path;
-	char *env;
+	log_init();
+	cpu_dispatch();
+}
 
-	/* open framebuffer device: check FRAMEBUFFER env at first */
-	path = ((env = getenv("FRAMEBUFFER")) == NULL) ? fb_path: env;
-	if ((fb->fd = eopen(path, O_RDWR)) < 0)
+static bool fb_open(struct framebuffer_t *fb, const struct fb_backend_t *backend, const char *path)
+{
+	cmap_t *cmap = NULL, *cmap_orig = NULL;
+	int64_t start;
+
+	fb->backend = backend;
+	fb->shadow  = NULL;
+	fb->diff.prev = NULL;
+	fb->glyph_cache = NULL;
+	fb->pool = NULL;
+	fb->flip.pages = 1;
+	fb->flip.front = 0;
+	fb->scroll.enabled = false;
+	memset(&fb->present, 0, sizeof(struct fb_present_t));
+	fb->dither.enabled = false;
+	memset(&fb->palette, 0, sizeof(struct fb_palette_t));
+	memset(&fb->stats, 0, sizeof(struct fb_stats_t));
+	pthread_once(&fb_once, fb_once_init);
+
+	/* open framebuffer device */
+	start = stats_clock();
+	if ((fb->fd = backend->open(path)) < 0)
 		return false;
+	start = stats_phase(fb, STATS_PHASE_OPEN, start);
 
-	/* os dependent initialize */
-	if (!set_fbinfo(fb->fd, &fb->info))
+	/* backend dependent initialize */
+	stats_ioctl(fb, STATS_IOCTL_FBINFO);
+	if (!backend->set_fbinfo(fb->fd, &fb->info))
 		goto set_fbinfo_failed;
+	info_set_size(&fb->info);
+	start = stats_phase(fb, STATS_PHASE_FBINFO, start);
 
-	if (VERBOSE)
-		fb_print_info(&fb->info);
+	logging(DEBUG, "backend:%s path:%s\n", backend->name, path);
+	fb_print_info(&fb->info);
+
+	if (fb->info.memory_size < fb->info.screen_size) {
+		logging(ERROR, "framebuffer memory (%ld) is smaller than visible area (%ld)\n",
+			fb->info.memory_size, fb->info.screen_size);
+		goto set_fbinfo_failed;
+	}
 
-	/* allocate memory */
+	/* map only visible area: virtual screen is mapped when page flipping/scrolling needs it */
 	fb->fp   = (uint8_t *) emmap(0, fb->info.screen_size,
 				PROT_WRITE | PROT_READ, MAP_SHARED, fb->fd, 0);
 
 	/* error check */
 	if (fb->fp == MAP_FAILED)
 		goto allocate_failed;
+	fb->buf = fb->fp;
+	fb->info.mapped_size = fb->info.screen_size;
+	start = stats_phase(fb, STATS_PHASE_MMAP, start);
+
+	if (prefault_enabled())
+		prefault(fb->fp, fb->info.screen_size);
+	start = stats_phase(fb, STATS_PHASE_PREFAULT, start);
 
 	if (fb->info.type != YAFT_FB_TYPE_PACKED_PIXELS) {
 		/* TODO: support planes type */
@@ -294,32 +400,88 @@ bool fb_init(struct framebuffer_t *fb)
 			goto fb_init_failed;
 	} else if (fb->info.visual == YAFT_FB_VISUAL_DIRECTCOLOR
 		|| fb->info.visual == YAFT_FB_VISUAL_PSEUDOCOLOR) {
-		if (!init_indexcolor(fb->fd, &fb->info, &cmap, &cmap_orig))
+		if (!init_indexcolor(fb, &cmap, &cmap_orig))
 			goto fb_init_failed;
 	} else {
 		/* TODO: support mono visual */
 		logging(ERROR, "unsupport framebuffer visual\n");
 		goto fb_init_failed;
 	}
+	fb->cmap      = cmap;
+	fb->cmap_orig = cmap_orig;
+	stats_phase(fb, STATS_PHASE_CMAP, start);
+
+	if (STATS)
+		logging(DEBUG, "init phase (usec): open:%ld fbinfo:%ld mmap:%ld prefault:%ld cmap:%ld\n",
+			(long) (fb->stats.init_phase[STATS_PHASE_OPEN] / 1000),
+			(long) (fb->stats.init_phase[STATS_PHASE_FBINFO] / 1000),
+			(long) (fb->stats.init_phase[STATS_PHASE_MMAP] / 1000),
+			(long) (fb->stats.init_phase[STATS_PHASE_PREFAULT] / 1000),
+			(long) (fb->stats.init_phase[STATS_PHASE_CMAP] / 1000));
+
+	/* select specialized pixel packer */
+	fb->info.format = get_format(&fb->info);
+	logging(DEBUG, "format:%s\n", format_str[fb->info.format]);
 
 	return true;
 
 fb_init_failed:
 allocate_failed:
 	if (fb->fp != MAP_FAILED)
-		emunmap(fb->fp, fb->info.screen_size);
+		emunmap(fb->fp, fb->info.mapped_size);
 set_fbinfo_failed:
 	eclose(fb->fd);
 	return false;
 }
 
+bool fb_init_virtual(struct framebuffer_t *fb, const struct fb_info_t *mode)
+{
+	/* virtual backend reads requested mode from fb->info in set_fbinfo() */
+	memset(&fb->info, 0, sizeof(struct fb_info_t));
+	if (mode)
+		fb->info = *mode;
+	else
+		virtual_default_mode(&fb->info);
+
+	return fb_open(fb, &fb_backend_virtual, "virtual");
+}
+
+/* native backend on given device path (e.g. "/dev/fb1"): FRAMEBUFFER and YAFB_BACKEND env are not used
+	each framebuffer_t owns its device state, so several devices can be driven from separate threads */
+bool fb_init_device(struct framebuffer_t *fb, const char *path)
+{
+	return fb_open(fb, &fb_backend_native, path);
+}
+
+bool fb_init(struct framebuffer_t *fb)
+{
+	extern const char *fb_path;               /* defined in conf.h */
+	const char *path;
+	char *env;
+
+	/* select backend: check YAFB_BACKEND env at first */
+	if ((env = getenv("YAFB_BACKEND")) != NULL && strcmp(env, "virtual") == 0)
+		return fb_init_virtual(fb, NULL);
+
+	/* open framebuffer device: check FRAMEBUFFER env at first */
+	path = ((env = getenv("FRAMEBUFFER")) == NULL) ? fb_path: env;
+	return fb_init_device(fb, path);
+}
+
 void fb_die(struct framebuffer_t *fb)
 {
-	cmap_die(cmap);
-	if (cmap_orig) {
-		put_cmap(fb->fd, cmap_orig);
-		cmap_die(cmap_orig);
+	fb_pool_die(fb);
+	fb_glyph_cache_die(fb);
+	fb_scroll_die(fb);
+	fb_flip_die(fb);
+	fb_shadow_die(fb);
+	fb_palette_die(fb);
+	cmap_die(fb->cmap);
+	if (fb->cmap_orig) {
+		stats_ioctl(fb, STATS_IOCTL_PUT_CMAP);
+		fb->backend->put_cmap(fb->fd, fb->cmap_orig);
+		cmap_die(fb->cmap_orig);
 	}
-	emunmap(fb->fp, fb->info.screen_size);
+	emunmap(fb->fp, fb->info.mapped_size);
 	eclose(fb->fd);
 }
@@ -2,6 +2,8 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
 
 #ifndef YAFBLIB_H
 #define YAFBLIB_H
@@ -20,32 +22,488 @@ enum fb_visual {
 	YAFT_FB_VISUAL_UNKNOWN,
 };
 
+enum fb_format {
+	YAFT_FB_FORMAT_GENERIC = 0,  /* any bitfields: converted by color2pixel_generic() */
+	YAFT_FB_FORMAT_XRGB8888,
+	YAFT_FB_FORMAT_XBGR8888,
+	YAFT_FB_FORMAT_RGB888,       /* 24bpp packed */
+	YAFT_FB_FORMAT_RGB565,
+	YAFT_FB_FORMAT_RGB555,
+	YAFT_FB_FORMAT_RGB332,       /* 8bpp pseudocolor fixed palette */
+};
+
 struct fb_info_t {
 	struct bitfield_t {
 		int length;
 		int offset;
 	} red, green, blue;
 	int width, height;      /* display resolution */
-	long screen_size;       /* screen data size (byte) */
+	long screen_size;       /* visible area: line_length * height (byte) */
+	long virtual_size;      /* virtual screen: line_length * height_virtual (byte), at most memory_size */
+	long memory_size;       /* framebuffer memory reported by backend (byte), may be much larger */
+	long mapped_size;       /* mapped from top of framebuffer memory (byte): visible area, or virtual screen
+	                           while page flipping/hardware scrolling is enabled */
 	int line_length;        /* line length (byte) */
+	int height_virtual;     /* virtual resolution (lines) */
+	int ypanstep;           /* 0: panning not supported */
 	int bits_per_pixel;
 	int bytes_per_pixel;
 	enum fb_type type;
 	enum fb_visual visual;
+	enum fb_format format;  /* set at fb_init() */
 	int reserved[4];        /* os specific data */
+	uint64_t backend_state[24]; /* backend specific (linux: fb_var_screeninfo cached for pan_display) */
+};
+
+struct fb_backend_t;              /* native or virtual (see backend.h) */
+
+/* dirty tiles of shadow buffer (see shadow.c) */
+struct fb_damage_t {
+	int cols, rows;           /* number of tiles */
+	bool *tiles;              /* dirty flag of each tile */
+	int count;                /* number of dirty tiles */
+};
+
+/* frame diff of shadow buffer (see shadow.c) */
+struct fb_diff_t {
+	uint8_t *prev;            /* previous flushed frame (NULL: disabled) */
+	unsigned long compared;   /* byte compared by fb_flush() */
+	unsigned long written;    /* byte written to framebuffer */
+};
+
+/* page flipping state (see flip.c) */
+struct fb_flip_t {
+	int pages;                /* 1: page flipping disabled */
+	int front;                /* page displayed now */
+	int height_virtual;       /* original virtual resolution (restored at fb_die) */
+};
+
+/* hardware scrolling state (see scroll.c) */
+struct fb_scroll_t {
+	bool enabled;             /* false: scroll by memmove */
+	int offset;               /* yoffset of visible window (fb->buf) */
+	int height_virtual;       /* original virtual resolution (restored at fb_die) */
+};
+
+/* presentation statistics (see present.c): time in nsec */
+struct fb_present_t {
+	bool vsync_unsupported;
+	unsigned long frames;          /* presented frames */
+	unsigned long vblanks;         /* waited vblanks */
+	unsigned long missed;          /* vblanks passed without presentation */
+	int64_t interval;              /* refresh period (shortest vblank interval) */
+	int64_t last_vblank;
+	int64_t latency_last, latency_max, latency_total; /* frame ready -> vblank */
+};
+
+/* ordered dithering (see dither.c) */
+struct fb_dither_t {
+	bool enabled;
+	uint32_t threshold[8][8]; /* added to color: (red << 16) | (green << 8) | blue */
+};
+
+/* palette animation: dirty entries of cmap (see palette.c) */
+struct fb_palette_t {
+	int colors;               /* entries of cmap (0: truecolor, no cmap) */
+	uint8_t *dirty;           /* per entry (NULL: not allocated yet) */
+	int first, last;          /* dirty entries are in [first, last) */
+	unsigned long uploads, entries; /* put_cmap_range calls, uploaded entries */
+};
+
+/* instrumentation (see stats.c): since fb_open() or fb_stats_reset(), time in nsec */
+enum fb_stats_ioctl {
+	STATS_IOCTL_FBINFO = 0,        /* set_fbinfo */
+	STATS_IOCTL_PUT_CMAP,          /* put_cmap, put_cmap_range */
+	STATS_IOCTL_GET_CMAP,
+	STATS_IOCTL_HEIGHT_VIRTUAL,    /* set_height_virtual */
+	STATS_IOCTL_PAN,               /* pan_display */
+	STATS_IOCTL_VSYNC,             /* wait_vsync */
+	STATS_IOCTL_NUM,
+};
+
+enum fb_stats_phase {
+	STATS_PHASE_OPEN = 0,
+	STATS_PHASE_FBINFO,
+	STATS_PHASE_MMAP,
+	STATS_PHASE_PREFAULT,          /* YAFB_PREFAULT=0: not prefaulted */
+	STATS_PHASE_CMAP,
+	STATS_PHASE_SHADOW,            /* fb_shadow_init(): allocation and copy of framebuffer */
+	STATS_PHASE_DIFF,              /* fb_diff_init(): same as above for previous frame */
+	STATS_PHASE_NUM,
+};
+
+enum fb_stats_misc {
+	STATS_HIST_BUCKETS = 20,       /* bucket i: [2^i, 2^(i + 1)) usec (bucket 0: < 2 usec, last: longer) */
+};
+
+struct fb_stats_t {
+	uint64_t vram_bytes;           /* written to framebuffer memory (drawing, flush, scroll) */
+	uint64_t pixels_converted;     /* 24bit color -> pixel (blit from other format, blend) */
+	uint64_t flushes;              /* fb_flush() with dirty tiles */
+	uint64_t ioctls[STATS_IOCTL_NUM]; /* backend calls by type */
+	unsigned long flush_hist[STATS_HIST_BUCKETS];   /* duration of fb_flush() */
+	unsigned long present_hist[STATS_HIST_BUCKETS]; /* fb_present(): call -> frame shown */
+	int64_t init_phase[STATS_PHASE_NUM];            /* fb_open() and buffer initialization */
+};
+
+/* raw video playback (see video.c) */
+enum fb_video_type {
+	VIDEO_FARBFELD = 0,            /* stream of farbfeld images (16bit RGBA) */
+	VIDEO_PPM,                     /* stream of ppm (P6) images */
+	VIDEO_RAW,                     /* headerless frames of given size and format */
+};
+
+struct fb_video_stats_t {
+	unsigned long shown;           /* frames written and presented */
+	unsigned long dropped;         /* frames skipped because they were late more than one interval */
+	unsigned long starved;         /* writer waited for reader (input or decode is slower than output) */
+};
+
+struct fb_video_t;
+
+/* screenshot (see capture.c) */
+enum fb_capture_type {
+	CAPTURE_FARBFELD = 0,          /* farbfeld image (16bit RGBA, opaque) */
+	CAPTURE_PPM,                   /* ppm (P6) image */
+	CAPTURE_RAW,                   /* headerless XRGB8888 (32bit colors in host byte order) */
+};
+
+/* glyph rendered in native pixel format (see glyph.c) */
+struct glyph_entry_t {
+	uint32_t code, fg, bg;    /* key */
+	int width, height;
+	uint32_t hash;
+	size_t size;              /* byte of this entry (including pixels) */
+	struct glyph_entry_t *hash_next;
+	struct glyph_entry_t *lru_prev, *lru_next;
+	uint8_t pixels[];         /* width * height * bytes_per_pixel */
+};
+
+struct glyph_cache_t {
+	struct glyph_entry_t **table; /* hash table (chained) */
+	size_t table_size;        /* power of 2 */
+	struct glyph_entry_t *lru_head, *lru_tail; /* most/least recently used */
+	size_t used, budget;      /* byte */
+	unsigned long hits, misses;
 };
 
 struct framebuffer_t {
 	int fd;                   /* file descriptor of framebuffer */
 	unsigned char *fp;        /* pointer of framebuffer */
+	unsigned char *buf;       /* drawing target: fp or shadow */
+	unsigned char *shadow;    /* shadow buffer (NULL: disabled) */
+	struct fb_damage_t damage;
+	struct fb_diff_t diff;
+	struct fb_flip_t flip;
+	struct fb_scroll_t scroll;
+	struct fb_present_t present;
+	struct fb_dither_t dither;
+	struct fb_palette_t palette;
+	struct fb_stats_t stats;
+	struct glyph_cache_t *glyph_cache; /* NULL: disabled */
+	struct thread_pool_t *pool;   /* NULL: single thread */
 	struct fb_info_t info;
-	//cmap_t *cmap, *cmap_orig; /* os specific cmap */
+	void *cmap, *cmap_orig;   /* os specific cmap_t (NULL: truecolor) */
+	const struct fb_backend_t *backend;
 };
 
-/* common framebuffer functions */
-//int cmap_update(int fd, cmap_t *cmap);
+/* pixel format: 24bit color (0xRRGGBB) -> framebuffer dependent pixel
+	specialized packers are selected by info->format (classified at fb_init)
+	inlined here to avoid call across library boundary for each pixel */
+static inline uint32_t color2xrgb8888(uint32_t color)
+{
+	return color & 0xFFFFFF;
+}
+
+static inline uint32_t color2xbgr8888(uint32_t color)
+{
+	return ((color & 0xFF0000) >> 16) | (color & 0x00FF00) | ((color & 0x0000FF) << 16);
+}
+
+static inline uint32_t color2rgb888(uint32_t color)
+{
+	/* same value as xrgb8888, but stored in 3 bytes */
+	return color & 0xFFFFFF;
+}
+
+static inline uint32_t color2rgb565(uint32_t color)
+{
+	return ((color >> 8) & 0xF800) | ((color >> 5) & 0x07E0) | ((color >> 3) & 0x001F);
+}
+
+static inline uint32_t color2rgb555(uint32_t color)
+{
+	return ((color >> 9) & 0x7C00) | ((color >> 6) & 0x03E0) | ((color >> 3) & 0x001F);
+}
+
+static inline uint32_t color2rgb332(uint32_t color)
+{
+	return ((color >> 16) & 0xE0) | ((color >> 11) & 0x1C) | ((color >> 6) & 0x03);
+}
+
+static inline uint32_t color2pixel_generic(struct fb_info_t *info, uint32_t color)
+{
+	uint32_t r, g, b;
+
+	r = 0xFF & (color >> 16);
+	g = 0xFF & (color >>  8);
+	b = 0xFF & (color >>  0);
+
+	r = r >> (8 - info->red.length);
+	g = g >> (8 - info->green.length);
+	b = b >> (8 - info->blue.length);
+
+	return (r << info->red.offset)
+			+ (g << info->green.offset)
+			+ (b << info->blue.offset);
+}
+
+/* inlined by drawing functions of library, applications use exported color2pixel() */
+static inline uint32_t color2pixel_inline(struct fb_info_t *info, uint32_t color)
+{
+	switch (info->format) {
+	case YAFT_FB_FORMAT_XRGB8888:
+		return color2xrgb8888(color);
+	case YAFT_FB_FORMAT_XBGR8888:
+		return color2xbgr8888(color);
+	case YAFT_FB_FORMAT_RGB888:
+		return color2rgb888(color);
+	case YAFT_FB_FORMAT_RGB565:
+		return color2rgb565(color);
+	case YAFT_FB_FORMAT_RGB555:
+		return color2rgb555(color);
+	case YAFT_FB_FORMAT_RGB332:
+		return color2rgb332(color);
+	default:
+		return color2pixel_generic(info, color);
+	}
+}
+
+/* 24bit color -> pixel of framebuffer (out of line: exported symbol of shared library) */
 uint32_t color2pixel(struct fb_info_t *info, uint32_t color);
+
+/* store pixel in framebuffer memory order (little endian) */
+static inline void store_pixel(uint8_t *dst, uint32_t pixel, int bytes_per_pixel)
+{
+	switch (bytes_per_pixel) {
+	case 4:
+		memcpy(dst, &pixel, 4);
+		break;
+	case 3:
+		dst[0] = pixel; dst[1] = pixel >> 8; dst[2] = pixel >> 16;
+		break;
+	case 2:
+		*dst++ = pixel; *dst = pixel >> 8;
+		break;
+	default:
+		*dst = pixel;
+		break;
+	}
+}
+
+/* inverse conversion: pixel -> 24bit color (lower bits are filled by bit replication) */
+static inline uint32_t expand_bits(uint32_t value, int length)
+{
+	/* value has length bits (1-8): replicate to 8 bits (0: component is absent) */
+	uint32_t ret;
+
+	if (length <= 0)
+		return 0;
+
+	ret = value << (8 - length);
+
+	for (int l = length; l < 8; l += length)
+		ret |= ret >> l;
+	return ret & 0xFF;
+}
+
+static inline uint32_t pixel2color_rgb565(uint32_t pixel)
+{
+	return (expand_bits((pixel >> 11) & 0x1F, 5) << 16)
+		| (expand_bits((pixel >> 5) & 0x3F, 6) << 8) | expand_bits(pixel & 0x1F, 5);
+}
+
+static inline uint32_t pixel2color_rgb555(uint32_t pixel)
+{
+	return (expand_bits((pixel >> 10) & 0x1F, 5) << 16)
+		| (expand_bits((pixel >> 5) & 0x1F, 5) << 8) | expand_bits(pixel & 0x1F, 5);
+}
+
+static inline uint32_t pixel2color_rgb332(uint32_t pixel)
+{
+	return (expand_bits((pixel >> 5) & 0x07, 3) << 16)
+		| (expand_bits((pixel >> 2) & 0x07, 3) << 8) | expand_bits(pixel & 0x03, 2);
+}
+
+static inline uint32_t pixel2color_generic(struct fb_info_t *info, uint32_t pixel)
+{
+	const struct bitfield_t *bf[] = {&info->red, &info->green, &info->blue};
+	uint32_t color = 0, value;
+
+	for (int i = 0; i < 3; i++) {
+		value = (pixel >> bf[i]->offset) & (uint32_t) ((1ULL << bf[i]->length) - 1);
+		value = (bf[i]->length > 8) ? value >> (bf[i]->length - 8): expand_bits(value, bf[i]->length);
+		color = (color << 8) | value;
+	}
+	return color;
+}
+
+static inline uint32_t load_pixel(const uint8_t *src, int bytes_per_pixel)
+{
+	uint32_t pixel = 0;
+
+	switch (bytes_per_pixel) {
+	case 4:
+		memcpy(&pixel, src, 4);
+		break;
+	case 3:
+		pixel = src[0] | (src[1] << 8) | (src[2] << 16);
+		break;
+	case 2:
+		pixel = src[0] | (src[1] << 8);
+		break;
+	default:
+		pixel = *src;
+		break;
+	}
+	return pixel;
+}
+
+/* 24bpp: group of 4 pixels is 12 bytes (3 words) */
+static inline void store_rgb888_x4(uint8_t *dst, uint32_t p0, uint32_t p1, uint32_t p2, uint32_t p3)
+{
+	uint32_t word[3];
+
+	word[0] = (p0 & 0xFFFFFF) | (p1 << 24);
+	word[1] = ((p1 >> 8) & 0xFFFF) | (p2 << 16);
+	word[2] = ((p2 >> 16) & 0xFF) | (p3 << 8);
+	memcpy(dst, word, 12);
+}
+
+static inline void load_rgb888_x4(uint32_t *dst, const uint8_t *src)
+{
+	uint32_t word[3];
+
+	memcpy(word, src, 12);
+	dst[0] = word[0] & 0xFFFFFF;
+	dst[1] = (word[0] >> 24) | ((word[1] & 0xFFFF) << 8);
+	dst[2] = (word[1] >> 16) | ((word[2] & 0xFF) << 16);
+	dst[3] = word[2] >> 8;
+}
+
+/* batch conversion: src (array of 24bit color) -> dst (framebuffer pixels, no alignment required) */
+void color2xrgb8888_n(uint8_t *dst, const uint32_t *src, int n);
+void color2xbgr8888_n(uint8_t *dst, const uint32_t *src, int n);
+void color2rgb888_n(uint8_t *dst, const uint32_t *src, int n);
+void color2rgb565_n(uint8_t *dst, const uint32_t *src, int n);
+void color2rgb555_n(uint8_t *dst, const uint32_t *src, int n);
+void color2rgb332_n(uint8_t *dst, const uint32_t *src, int n);
+void color2pixel_generic_n(struct fb_info_t *info, uint8_t *dst, const uint32_t *src, int n);
+void color2pixel_n(struct fb_info_t *info, uint8_t *dst, const uint32_t *src, int n);
+/* threshold: dither row of fb_dither_t (threshold[i & 7] is for pixel i) or NULL */
+void color2pixel_dither_n(struct fb_info_t *info, uint8_t *dst, const uint32_t *src, int n, const uint32_t *threshold);
+
+/* inverse batch conversion: src (pixels of format) -> dst (array of 24bit color) */
+void pixel2color_rgb565_n(uint32_t *dst, const uint8_t *src, int n);
+void pixel2color_rgb555_n(uint32_t *dst, const uint8_t *src, int n);
+void pixel2color_rgb888_n(uint32_t *dst, const uint8_t *src, int n);
+void pixel2color_rgb332_n(uint32_t *dst, const uint8_t *src, int n);
+void pixel2color_generic_n(struct fb_info_t *info, uint32_t *dst, const uint8_t *src, int n);
+bool pixel2color_n(enum fb_format format, uint32_t *dst, const uint8_t *src, int n);
+int format_bytes_per_pixel(enum fb_format format);
+
+/* thread pool: threads including caller (<= 0: number of online cpus)
+	fb_pool_run() calls func for bands of lines [0, height), size: byte written by operation */
+bool fb_pool_init(struct framebuffer_t *fb, int threads);
+void fb_pool_die(struct framebuffer_t *fb);
+void fb_pool_run(struct framebuffer_t *fb, void (*func)(void *arg, int y, int height), void *arg, int height, long size);
+
+/* solid fill: pixel (already converted) or 24bit color (clipped by screen) */
+void fill_row(struct fb_info_t *info, uint8_t *dst, uint32_t pixel, int n);
+void fb_fill_rect(struct framebuffer_t *fb, int x, int y, int width, int height, uint32_t color);
+void fb_clear(struct framebuffer_t *fb, uint32_t color);
+
+/* blit: src (format, stride: bytes per line) -> (x, y) of screen (clipped) */
+void blit_row(struct fb_info_t *info, uint8_t *dst, const uint8_t *src, enum fb_format src_format, int n);
+void fb_blit(struct framebuffer_t *fb, int x, int y, const uint8_t *src, int src_stride,
+	enum fb_format src_format, int width, int height);
+
+/* alpha blending: premultiplied ARGB32 src over screen (source-over) */
+void blend_over_n(uint32_t *dst, const uint32_t *src, int n);
+void blend_row(struct fb_info_t *info, uint8_t *dst, const uint32_t *src, int n);
+void fb_blend(struct framebuffer_t *fb, int x, int y, const uint32_t *src, int src_stride,
+	int width, int height);
+
+/* glyph cache: bitmap is 1bpp MSB first (width <= 32), budget: byte */
+bool fb_glyph_cache_init(struct framebuffer_t *fb, size_t budget);
+void fb_glyph_cache_die(struct framebuffer_t *fb);
+void fb_draw_glyph(struct framebuffer_t *fb, int x, int y, uint32_t code,
+	const uint32_t *bitmap, int width, int height, uint32_t fg, uint32_t bg);
+
+/* hardware scrolling: lines > 0: scroll up, exposed lines are filled by color
+	without fb_scroll_init() (or panning), scroll is memmove */
+bool fb_scroll_init(struct framebuffer_t *fb);
+void fb_scroll(struct framebuffer_t *fb, int lines, uint32_t color);
+void fb_scroll_die(struct framebuffer_t *fb);
+
+/* raw video playback: frames are read and decoded by reader thread, converted and presented by caller at fps
+	path: file (mapped) or pipe ("-": stdin), width/height/format are used only for VIDEO_RAW */
+struct fb_video_t *fb_video_open(const char *path, enum fb_video_type type, int width, int height, enum fb_format format);
+bool fb_video_play(struct framebuffer_t *fb, struct fb_video_t *video, int fps, struct fb_video_stats_t *stats);
+void fb_video_close(struct fb_video_t *video);
+
+/* screenshot of visible screen (shadow buffer if enabled) to fp: return false on write error */
+bool fb_capture(struct framebuffer_t *fb, FILE *fp, enum fb_capture_type type);
+
+/* shadow buffer: drawing functions write fb->buf and mark damage, fb_flush() copies dirty tiles */
+bool fb_shadow_init(struct framebuffer_t *fb);
+void fb_shadow_die(struct framebuffer_t *fb);
+void fb_damage(struct framebuffer_t *fb, int x, int y, int width, int height);
+void fb_damage_all(struct framebuffer_t *fb);
+void fb_flush(struct framebuffer_t *fb);
+
+/* frame diff: fb_flush() writes only changed spans (enables shadow buffer) */
+bool fb_diff_init(struct framebuffer_t *fb);
+void fb_diff_die(struct framebuffer_t *fb);
+
+/* page flipping: draw into fb->buf (back page), fb_flip() pans display to it */
+bool fb_flip_init(struct framebuffer_t *fb, int pages);
+bool fb_flip(struct framebuffer_t *fb);
+void fb_flip_die(struct framebuffer_t *fb);
+
+/* ordered dithering of blit/blend (RGB332/RGB565/RGB555 only) */
+bool fb_dither_init(struct framebuffer_t *fb);
+void fb_dither_die(struct framebuffer_t *fb);
+
+/* palette animation (PSEUDOCOLOR/DIRECTCOLOR): colors are 24bit, rotate: entry i moves to i + shift
+	modified entries are uploaded in coalesced ranges by fb_palette_commit() (called by fb_present()) */
+bool fb_palette_set(struct framebuffer_t *fb, int start, const uint32_t *colors, int n);
+bool fb_palette_rotate(struct framebuffer_t *fb, int start, int n, int shift);
+bool fb_palette_commit(struct framebuffer_t *fb);
+void fb_palette_die(struct framebuffer_t *fb);
+
+/* instrumentation: counters, flush/present latency histograms, init phase timings
+	(build with -DYAFB_NO_STATS to remove them) */
+void fb_stats_snapshot(struct framebuffer_t *fb, struct fb_stats_t *stats);
+void fb_stats_reset(struct framebuffer_t *fb);
+
+/* log level ("debug", "warn", "error" or "fatal", also read from YAFB_LOG env by fb_init())
+	ring buffer sink: messages are stored on memory (lock-free, dropped if full) until fb_log_ring_drain() */
+bool fb_log_set_level(const char *name);
+bool fb_log_ring_init(int records);
+int fb_log_ring_drain(FILE *fp);
+void fb_log_ring_die(void);
+
+/* presentation: fb_flip() synchronized to vblank (if vsync)
+	shadow flush: wait for vblank, then copy; page flipping: pan, then wait for vblank before fb->buf is reused */
+bool fb_present(struct framebuffer_t *fb, bool vsync);
+void fb_present_reset(struct framebuffer_t *fb);
+
+/* common framebuffer functions */
+//int cmap_update(struct framebuffer_t *fb, cmap_t *cmap);
 bool fb_init(struct framebuffer_t *fb);
+bool fb_init_device(struct framebuffer_t *fb, const char *path);
+bool fb_init_virtual(struct framebuffer_t *fb, const struct fb_info_t *mode);
 void fb_die(struct framebuffer_t *fb);
 
 #endif /* YAFBLIB_H */
@@ -1,33 +1,30 @@
 /* See LICENSE for licence details. */
 #include "include/yafblib.h"
 
-void draw_point(struct framebuffer_t *fb, int height, int width, uint32_t color)
-{
-	uint32_t pixel;
-
-	/* color2pixel convert from 24/32bit color (see color.h)
-		to framebuffer dependent pixel format */
-	pixel = color2pixel(&fb->info, color);
-
-	memcpy(fb->fp + height * fb->info.line_length
-		+ width * fb->info.bytes_per_pixel, &pixel, fb->info.bytes_per_pixel);
-}
-
 int main()
 {
 	struct framebuffer_t fb;
+	uint32_t *line;
 
 	/* initialize framebuffer at first */
 	if (fb_init(&fb) == false)
 		return EXIT_FAILURE;
 
-	/* draw something */
-	for (int h = 0; h < fb.info.height; h++) {
-		for (int w = 0; w < fb.info.width; w++) {
-			draw_point(&fb, h, w, h * fb.info.width + w);
+	/* draw something: fb_blit() converts 24/32bit color of each line
+		to framebuffer dependent pixel format at once (see blit.h) */
+	if ((line = (uint32_t *) malloc(sizeof(uint32_t) * fb.info.width)) != NULL) {
+		for (int h = 0; h < fb.info.height; h++) {
+			for (int w = 0; w < fb.info.width; w++)
+				line[w] = (h * fb.info.width + w) & 0xFFFFFF;
+			fb_blit(&fb, 0, h, (uint8_t *) line, 0, YAFT_FB_FORMAT_XRGB8888, fb.info.width, 1);
 		}
+		free(line);
 	}
 
+	/* fill rectangle (clipped by screen size) */
+	fb_fill_rect(&fb, fb.info.width / 4, fb.info.height / 4,
+		fb.info.width / 2, fb.info.height / 2, 0xFFFFFF);
+
 	/* release framebuffer */
 	fb_die(&fb);
 	return EXIT_SUCCESS;